@@ -20,13 +20,13 @@ public class Buttplug : ModuleRules
         PublicDependencyModuleNames.AddRange(new string[]
 		{
 			"Core",
+			"DeveloperSettings",
         });
 		
 		PrivateDependencyModuleNames.AddRange(new string[]
         {
             "CoreUObject",
             "Engine",
-			"Json",
 			"WebSockets",
 		});
 
@@ -5,6 +5,8 @@
 #include "CoreMinimal.h"
 #include "ButtplugMinimal.h"
 
+#include "Containers/StringView.h"
+
 namespace Buttplug::Private
 {
 
@@ -56,4 +58,166 @@ FString GetEnumAsString(EnumType Value)
 	return Enum->GetNameStringByValue(static_cast<int64>(Value));
 }
 
+/// The name of an enum value, taken from the stringized `EnumType::Value` emitted by UHT's FOREACH_ENUM_ macros.
+struct FEnumName
+{
+	const ANSICHAR* Chars = nullptr;
+	int32 Len = 0;
+
+	template<int32 N>
+	constexpr FEnumName(const ANSICHAR (&QualifiedName)[N])
+	{
+		int32 Start = 0;
+		for (int32 Index = 0; Index < N - 1; ++Index)
+		{
+			if (QualifiedName[Index] == ':') Start = Index + 1;
+		}
+		Chars = QualifiedName + Start;
+		Len = N - 1 - Start;
+	}
+};
+
+/// Specialized by BUTTPLUG_DEFINE_ENUM_NAMES for enums with a compile-time name table.
+template<typename EnumType>
+struct TEnumNameTraits
+{
+	static constexpr bool bDefined = false;
+};
+
+/// Hash an enum name for TEnumNameTable. FNV-1a, keeping the high bits since the low bits of an FNV product
+/// don't mix in the higher bits of the seed.
+template<typename CharType>
+constexpr int32 HashEnumName(const CharType* Chars, int32 Len, uint32 Seed, int32 HashBits)
+{
+	uint32 Hash = 2166136261u ^ Seed;
+	for (int32 Index = 0; Index < Len; ++Index)
+	{
+		Hash = (Hash ^ static_cast<uint32>(Chars[Index])) * 16777619u;
+	}
+	return static_cast<int32>(Hash >> (32 - HashBits));
+}
+
+constexpr int32 GetEnumNameHashBits(int32 Num)
+{
+	// Leave at least half of the buckets empty so that finding a collision-free seed is easy.
+	int32 Bits = 0;
+	while ((1 << Bits) < Num * 2) ++Bits;
+	return Bits;
+}
+
+template<int32 NumBuckets>
+struct TEnumNameBuckets
+{
+	int8 Entries[NumBuckets] = {};
+	bool bPerfect = true;
+};
+
+template<typename EnumType, int32 HashBits>
+constexpr TEnumNameBuckets<1 << HashBits> MakeEnumNameBuckets()
+{
+	using FTraits = TEnumNameTraits<EnumType>;
+	TEnumNameBuckets<1 << HashBits> Buckets;
+	for (int8& Entry : Buckets.Entries)
+	{
+		Entry = INDEX_NONE;
+	}
+	for (int32 Index = 0; Index < static_cast<int32>(UE_ARRAY_COUNT(FTraits::Names)); ++Index)
+	{
+		int8& Entry = Buckets.Entries[HashEnumName(FTraits::Names[Index].Chars, FTraits::Names[Index].Len, FTraits::HashSeed, HashBits)];
+		Buckets.bPerfect &= Entry == INDEX_NONE;
+		Entry = static_cast<int8>(Index);
+	}
+	return Buckets;
+}
+
+template<typename EnumType>
+constexpr bool AreEnumValuesContiguous()
+{
+	using FTraits = TEnumNameTraits<EnumType>;
+	for (int32 Index = 0; Index < static_cast<int32>(UE_ARRAY_COUNT(FTraits::Values)); ++Index)
+	{
+		if (static_cast<int32>(FTraits::Values[Index]) != Index) return false;
+	}
+	return true;
+}
+
+/// Compile-time, perfectly hashed, bidirectional table between enum values and their names.
+/// Used on the message hot path instead of UEnum reflection, which allocates and searches by string.
+template<typename EnumType>
+struct TEnumNameTable
+{
+	using FTraits = TEnumNameTraits<EnumType>;
+	static_assert(FTraits::bDefined, "Missing BUTTPLUG_DEFINE_ENUM_NAMES for this enum");
+	static_assert(AreEnumValuesContiguous<EnumType>(), "Enum name tables require enum values to count up from zero");
+
+	static constexpr int32 Num = UE_ARRAY_COUNT(FTraits::Names);
+	static_assert(Num < MAX_int8, "Enum name table too large for its hash buckets");
+
+	static constexpr int32 HashBits = GetEnumNameHashBits(Num);
+	static constexpr TEnumNameBuckets<1 << HashBits> Buckets = MakeEnumNameBuckets<EnumType, HashBits>();
+	static_assert(Buckets.bPerfect, "Enum names collide in the name table; change the HashSeed in BUTTPLUG_DEFINE_ENUM_NAMES");
+
+	template<typename CharType>
+	static bool Find(const CharType* Chars, int32 Len, EnumType& OutValue)
+	{
+		int32 Index = Buckets.Entries[HashEnumName(Chars, Len, FTraits::HashSeed, HashBits)];
+		if (Index == INDEX_NONE || FTraits::Names[Index].Len != Len) return false;
+		for (int32 CharIndex = 0; CharIndex < Len; ++CharIndex)
+		{
+			if (static_cast<uint32>(FTraits::Names[Index].Chars[CharIndex]) != static_cast<uint32>(Chars[CharIndex])) return false;
+		}
+		OutValue = FTraits::Values[Index];
+		return true;
+	}
+};
+
+/// Get the name of an enum value without UEnum reflection or allocation.
+template<typename EnumType>
+FAnsiStringView GetEnumName(EnumType Value)
+{
+	using FTable = TEnumNameTable<EnumType>;
+	int32 Index = static_cast<int32>(Value);
+	check(Index >= 0 && Index < FTable::Num);
+	const FEnumName& Name = FTable::FTraits::Names[Index];
+	return FAnsiStringView(Name.Chars, Name.Len);
+}
+
+/// Look up an enum value by name without UEnum reflection or allocation.
+template<typename EnumType>
+bool FindEnumByName(FStringView Name, EnumType& OutValue)
+{
+	return TEnumNameTable<EnumType>::Find(Name.GetData(), Name.Len(), OutValue);
+}
+
+/// Look up an enum value by name without UEnum reflection or allocation.
+template<typename EnumType>
+bool FindEnumByName(FAnsiStringView Name, EnumType& OutValue)
+{
+	return TEnumNameTable<EnumType>::Find(Name.GetData(), Name.Len(), OutValue);
+}
+
 } // namespace Buttplug::Private
+
+#define BUTTPLUG_ENUM_VALUE(Value) Value,
+#define BUTTPLUG_ENUM_NAME(Value) Buttplug::Private::FEnumName(#Value),
+
+/**
+ * Define the compile-time name table for a UENUM, generated from its UHT FOREACH_ENUM_ macro
+ * so that adding an enum value can't leave the table out of date.
+ *
+ * @param	EnumType			The enum type
+ * @param	ForEachEnumMacro	The UHT generated FOREACH_ENUM_<ENUMTYPE> macro
+ * @param	InHashSeed			Seed for the name hash; must give a collision-free hash (checked at compile time)
+ */
+#define BUTTPLUG_DEFINE_ENUM_NAMES(EnumType, ForEachEnumMacro, InHashSeed) \
+	namespace Buttplug::Private \
+	{ \
+		template<> \
+		struct TEnumNameTraits<EnumType> \
+		{ \
+			static constexpr bool bDefined = true; \
+			static constexpr uint32 HashSeed = InHashSeed; \
+			static constexpr EnumType Values[] = { ForEachEnumMacro(BUTTPLUG_ENUM_VALUE) }; \
+			static constexpr FEnumName Names[] = { ForEachEnumMacro(BUTTPLUG_ENUM_NAME) }; \
+		}; \
+	}
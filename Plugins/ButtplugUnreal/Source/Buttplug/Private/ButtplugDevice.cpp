@@ -4,9 +4,21 @@
 
 #include "ButtplugConversions.h"
 #include "ButtplugFeature.h"
+#include "ButtplugFeatureStore.h"
 #include "ButtplugMessage.h"
+#include "ButtplugMessageTracker.h"
+#include "ButtplugSettings.h"
 #include "ButtplugSubsystem.h"
 
+UButtplugDevice::UButtplugDevice() = default;
+
+UButtplugDevice::UButtplugDevice(FVTableHelper& Helper)
+    : Super(Helper)
+{
+}
+
+UButtplugDevice::~UButtplugDevice() = default;
+
 const FString& UButtplugDevice::GetDescriptiveName() const
 {
     return DescriptiveName;
@@ -27,27 +39,21 @@ bool UButtplugDevice::IsConnected() const
     return bConnected;
 }
 
-void UButtplugDevice::GetActuators(EButtplugFeatureType ActuatorType, TArray<UButtplugFeature*> Actuators) const
+void UButtplugDevice::GetActuators(EButtplugFeatureType ActuatorType, TArray<UButtplugFeature*>& Actuators) const
 {
-    Actuators.Empty();
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
+    Actuators.Reset();
+    for (int32 FeatureIndex : ActuatorsByType.Get(ActuatorType))
     {
-        if (Feature->GetFeatureType() == ActuatorType && Feature->IsActuator())
-        {
-            Actuators.Add(Feature);
-        }
+        Actuators.Add(Features[FeatureIndex]);
     }
 }
 
-void UButtplugDevice::GetSensors(EButtplugFeatureType SensorType, TArray<UButtplugFeature*> Sensors) const
+void UButtplugDevice::GetSensors(EButtplugFeatureType SensorType, TArray<UButtplugFeature*>& Sensors) const
 {
-    Sensors.Empty();
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
+    Sensors.Reset();
+    for (int32 FeatureIndex : SensorsByType.Get(SensorType))
     {
-        if (Feature->GetFeatureType() == SensorType && Feature->IsSensor())
-        {
-            Sensors.Add(Feature);
-        }
+        Sensors.Add(Features[FeatureIndex]);
     }
 }
 
@@ -59,6 +65,23 @@ float UButtplugDevice::GetMessageTimingGap() const
 void UButtplugDevice::SetMessageTimingGap(float Override)
 {
     MessageTimingGapOverride = Override;
+    UpdateSendIntervalLimits();
+}
+
+float UButtplugDevice::GetEffectiveMessageInterval() const
+{
+    return GetSubsystem()->GetDeviceSendInterval(DeviceIndex, GetMessageTimingGap());
+}
+
+float UButtplugDevice::GetEffectiveSendRate() const
+{
+    float Interval = GetEffectiveMessageInterval();
+    return Interval > 0 ? 1.0f / Interval : 0.0f;
+}
+
+FButtplugLatencyStats UButtplugDevice::GetLatencyStats() const
+{
+    return GetSubsystem()->GetDeviceLatencyStats(DeviceIndex);
 }
 
 bool UButtplugDevice::CanVibrate() const
@@ -93,14 +116,7 @@ bool UButtplugDevice::CanPosition() const
 
 bool UButtplugDevice::CanActuate(EButtplugFeatureType ActuatorType) const
 {
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
-    {
-        if (Feature->GetFeatureType() == ActuatorType)
-        {
-            return true;
-        }
-    }
-    return false;
+    return ActuatorsByType.Contains(ActuatorType);
 }
 
 void UButtplugDevice::VibrateAll(double Value, float Duration)
@@ -137,12 +153,9 @@ void UButtplugDevice::ActuateAll(EButtplugFeatureType ActuatorType, double Value
 {
     if (!IsConnected()) return;
 
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
+    for (int32 FeatureIndex : ActuatorsByType.Get(ActuatorType))
     {
-        if (Feature->GetFeatureType() == ActuatorType && Feature->IsActuator())
-        {
-            Feature->Actuate(Value, Duration);
-        }
+        Features[FeatureIndex]->Actuate(Value, Duration);
     }
 }
 
@@ -150,20 +163,16 @@ void UButtplugDevice::StopAll(EButtplugFeatureType ActuatorType)
 {
     if (!IsConnected()) return;
 
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
+    for (int32 FeatureIndex : ActuatorsByType.Get(ActuatorType))
     {
-        if (Feature->GetFeatureType() == ActuatorType && Feature->IsActuator())
-        {
-            Feature->Actuate(0.0, INFINITY);
-        }
+        Features[FeatureIndex]->Actuate(0.0, INFINITY);
     }
 }
 
 void UButtplugDevice::Stop()
 {
     if (!IsConnected()) return;
-
-    bHasQueuedStopDevice = true;
+    GetSubsystem()->StopDevice(GetHandle());
 }
 
 bool UButtplugDevice::HasBatteryLevel() const
@@ -173,30 +182,20 @@ bool UButtplugDevice::HasBatteryLevel() const
 
 float UButtplugDevice::GetBatteryLevel() const
 {
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
-    {
-        if (Feature->GetFeatureType() == EButtplugFeatureType::Battery && Feature->IsSensor())
-        {
-            const TArray<int32>& Reading = Feature->GetLastSensorReading();
-            if (Reading.IsEmpty()) break;
-            int32 IntLevel = Reading[0];
-            FInt32Interval LevelRange = Feature->GetSensorRange()[0];
-            return (IntLevel + LevelRange.Min) / float(LevelRange.Size());
-        }
-    }
-    return -1.0f;
+    TArrayView<const int32> Batteries = SensorsByType.Get(EButtplugFeatureType::Battery);
+    if (Batteries.IsEmpty()) return -1.0f;
+
+    const UButtplugFeature* Feature = Features[Batteries[0]];
+    const TArray<int32>& Reading = Feature->GetLastSensorReading();
+    if (Reading.IsEmpty()) return -1.0f;
+    int32 IntLevel = Reading[0];
+    FInt32Interval LevelRange = Feature->GetSensorRange()[0];
+    return (IntLevel + LevelRange.Min) / float(LevelRange.Size());
 }
 
 bool UButtplugDevice::CanSense(EButtplugFeatureType SensorType) const
 {
-    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
-    {
-        if (Feature->GetFeatureType() == SensorType && Feature->IsSensor())
-        {
-            return true;
-        }
-    }
-    return false;
+    return SensorsByType.Contains(SensorType);
 }
 
 UButtplugSubsystem* UButtplugDevice::GetSubsystem() const
@@ -206,100 +205,236 @@ UButtplugSubsystem* UButtplugDevice::GetSubsystem() const
 
 void UButtplugDevice::SetConnected(bool bInConnected)
 {
-    bConnected = bInConnected;
+    {
+        FScopeLock Lock(&GetSubsystem()->GetHapticsLock());
+        bConnected = bInConnected;
+        if (StoreSlot != INDEX_NONE)
+        {
+            // Whatever we last sent may not be what the device is doing anymore.
+            GetFeatureStore().SetConnected(StoreSlot, bConnected);
+        }
+        if (!bConnected)
+        {
+            // Reads still waiting on the send interval won't be answered; failing them lets their features read again.
+            for (int32 Index = 0; Index < MessageQueue.Num();)
+            {
+                if (MessageQueue[Index].GetMessageType() == EButtplugMessageType::SensorReadCmd)
+                {
+                    GetSubsystem()->MessageTracker->Drop(MessageQueue[Index].GetMessage().Id);
+                    MessageQueue.RemoveAt(Index, 1, /*bAllowShrinking:*/false);
+                }
+                else
+                {
+                    ++Index;
+                }
+            }
+        }
+    }
     if (bConnected)
     {
+        // The server forgets subscriptions along with the device; replay the ones still wanted.
+        UpdateSensorSubscriptions();
         OnConnected.Broadcast();
     }
     else
     {
+        for (UButtplugFeature* Feature : Features)
+        {
+            Feature->bServerSubscribed = false;
+        }
         OnDisconnected.Broadcast();
     }
 }
 
-void UButtplugDevice::FlushMessageQueue(float DeltaTime)
+void UButtplugDevice::UpdateSensorSubscriptions()
 {
-    TimeSinceLastMessage += DeltaTime;
-    if (TimeSinceLastMessage < GetMessageTimingGap())
+    for (UButtplugFeature* Feature : Features)
     {
-        return;
+        Feature->UpdateSubscription();
+    }
+}
+
+TArrayView<const int32> UButtplugDevice::FFeatureTypeIndex::Get(EButtplugFeatureType Type) const
+{
+    int32 TypeIndex = static_cast<int32>(Type);
+    if (!Contains(Type)) return {};
+    return MakeArrayView(FeatureIndices.GetData() + Offsets[TypeIndex], Offsets[TypeIndex + 1] - Offsets[TypeIndex]);
+}
+
+namespace Buttplug::Private
+{
+
+constexpr int32 NumFeatureTypes = TEnumNameTable<EButtplugFeatureType>::Num;
+static_assert(NumFeatureTypes <= 32, "Feature type masks only have room for 32 feature types");
+
+} // namespace Buttplug::Private
+
+void UButtplugDevice::FFeatureTypeIndex::Build(const TArray<TObjectPtr<UButtplugFeature>>& Features, TFunctionRef<bool(const UButtplugFeature&)> Filter)
+{
+    using Buttplug::Private::NumFeatureTypes;
+    TypeMask = 0;
+    Offsets.Init(0, NumFeatureTypes + 1);
+    for (const TObjectPtr<UButtplugFeature>& Feature : Features)
+    {
+        if (Filter(*Feature))
+        {
+            int32 TypeIndex = static_cast<int32>(Feature->GetFeatureType());
+            TypeMask |= 1u << TypeIndex;
+            ++Offsets[TypeIndex + 1];
+        }
+    }
+    for (int32 TypeIndex = 0; TypeIndex < NumFeatureTypes; ++TypeIndex)
+    {
+        Offsets[TypeIndex + 1] += Offsets[TypeIndex];
+    }
+
+    // Fill each type's range in feature order.
+    TArray<int32, TInlineAllocator<NumFeatureTypes>> Next(Offsets.GetData(), NumFeatureTypes);
+    FeatureIndices.SetNumUninitialized(Offsets[NumFeatureTypes]);
+    for (int32 FeatureIndex = 0; FeatureIndex < Features.Num(); ++FeatureIndex)
+    {
+        if (Filter(*Features[FeatureIndex]))
+        {
+            FeatureIndices[Next[static_cast<int32>(Features[FeatureIndex]->GetFeatureType())]++] = FeatureIndex;
+        }
+    }
+}
+
+void UButtplugDevice::BuildFeatureIndex()
+{
+    for (int32 FeatureIndex = 0; FeatureIndex < Features.Num(); ++FeatureIndex)
+    {
+        Features[FeatureIndex]->FeatureIndex = FeatureIndex;
     }
+    ActuatorsByType.Build(Features, [](const UButtplugFeature& Feature) { return Feature.IsActuator(); });
+    SensorsByType.Build(Features, [](const UButtplugFeature& Feature) { return Feature.IsSensor(); });
+}
 
-    if (bHasQueuedStopDevice)
+void UButtplugDevice::RemoveFromFeatureStore()
+{
+    if (StoreSlot == INDEX_NONE) return;
+    GetFeatureStore().RetireDevice(StoreSlot);
+    StoreSlot = INDEX_NONE;
+    for (TObjectPtr<UButtplugFeature> Feature : Features)
     {
-        TUniquePtr<FButtplugMessage::StopDeviceCmd> StopCmd = MakeUnique<FButtplugMessage::StopDeviceCmd>();
-        StopCmd->DeviceIndex = DeviceIndex;
-        GetSubsystem()->EnqueueMessage(MoveTemp(StopCmd));
+        Feature->StoreRow = INDEX_NONE;
+    }
+}
+
+void UButtplugDevice::AddToFeatureStore(TArrayView<const FFeatureCmd> FeatureCmds)
+{
+    FButtplugFeatureStore& Store = GetFeatureStore();
+    StoreSlot = Store.AddDevice(DeviceIndex, Features.Num());
+    Handle = Store.GetDeviceHandle(StoreSlot);
 
-        for (TObjectPtr<UButtplugFeature> Feature : Features)
+    check(FeatureCmds.Num() == Features.Num());
+    const int32 FirstRow = Store.DeviceSlots[StoreSlot].FirstRow;
+    for (int32 Index = 0; Index < Features.Num(); ++Index)
+    {
+        UButtplugFeature* Feature = Features[Index];
+        const int32 Row = FirstRow + Index;
+        Feature->StoreRow = Row;
+        Feature->Handle = Store.GetFeatureHandle(Row);
+        const FFeatureCmd& FeatureCmd = FeatureCmds[Index];
+        bool bActuator = FButtplugFeatureStore::IsActuatorCmd(FeatureCmd.CmdType);
+        Store.SetCommand(Row, FeatureCmd.CmdType, FeatureCmd.CmdIndex, Feature->FeatureType, bActuator ? Feature->GetStepGrid() : 1);
+        if (bActuator)
         {
-            // Cancel any already queued acutation if we're stopping the device this tick.
-            Feature->bHasQueuedActuation = false;
+            Store.SetResponseTable(Row, Feature->MakeResponseTable());
         }
     }
-    else
+}
+
+FButtplugFeatureStore& UButtplugDevice::GetFeatureStore() const
+{
+    return *GetSubsystem()->FeatureStore;
+}
+
+void UButtplugDevice::CancelQueuedActuation()
+{
+    if (StoreSlot == INDEX_NONE) return;
+    GetFeatureStore().CancelQueued(StoreSlot);
+}
+
+void UButtplugDevice::UpdateSendIntervalLimits()
+{
+    GetSubsystem()->SetDeviceSendIntervalLimits(DeviceIndex, GetMessageTimingGap(), GetDefault<UButtplugSettings>()->MaxSendInterval);
+}
+
+void UButtplugDevice::FlushMessageQueue(float DeltaTime)
+{
+    TimeSinceLastMessage += DeltaTime;
+    if (TimeSinceLastMessage < GetEffectiveMessageInterval())
     {
-        TUniquePtr<FButtplugMessage::LinearCmd> LinearCmd;
-        TUniquePtr<FButtplugMessage::RotateCmd> RotateCmd;
-        TUniquePtr<FButtplugMessage::ScalarCmd> ScalarCmd;
+        return;
+    }
+    bool bSentMessage = !MessageQueue.IsEmpty();
 
-        for (TObjectPtr<UButtplugFeature> Feature : Features)
+    if (!GetSubsystem()->IsHoldingActuation())
+    {
+        // Built on the stack with inline storage, then moved into the subsystem's flat message buffer.
+        FButtplugMessage::LinearCmd LinearCmd;
+        FButtplugMessage::RotateCmd RotateCmd;
+        FButtplugMessage::ScalarCmd ScalarCmd;
+        LinearCmd.DeviceIndex = DeviceIndex;
+        RotateCmd.DeviceIndex = DeviceIndex;
+        ScalarCmd.DeviceIndex = DeviceIndex;
+
+        const double Now = FPlatformTime::Seconds();
+        const float KeepAliveInterval = GetDefault<UButtplugSettings>()->ActuationKeepAliveInterval;
+        FButtplugFeatureStore& Store = GetFeatureStore();
+        const FButtplugFeatureStore::FDeviceSlot& Slot = Store.DeviceSlots[StoreSlot];
+        for (int32 Row = Slot.FirstRow; Row < Slot.FirstRow + Slot.NumRows; ++Row)
         {
-            if (Feature->bHasQueuedActuation)
-            {
-                Feature->bHasQueuedActuation = false;
-                checkf(Feature->IsActuator(), TEXT("Should not queue a Buttplug device feature actuation if feature cannot actuate"));
+            if (!Store.Consume(Row, Now, KeepAliveInterval)) continue;
 
-                if (Feature->LinearCmdIndex != INDEX_NONE)
-                {
-                    if (!LinearCmd)
-                    {
-                        LinearCmd = MakeUnique<FButtplugMessage::LinearCmd>();
-                        LinearCmd->DeviceIndex = DeviceIndex;
-                    }
-                    FButtplugMessage::Vector Vector;
-                    Vector.Index = Feature->LinearCmdIndex;
-                    Vector.Duration = FMath::RoundToInt32(Feature->QueuedActuation.Duration * 1000); // convert s -> ms
-                    Vector.Position = Feature->QueuedActuation.Value;
-                    LinearCmd->Vectors.Add(Vector);
-                }
-                else if (Feature->RotateCmdIndex != INDEX_NONE)
-                {
-                    if (!RotateCmd)
-                    {
-                        RotateCmd = MakeUnique<FButtplugMessage::RotateCmd>();
-                        RotateCmd->DeviceIndex = DeviceIndex;
-                    }
-                    FButtplugMessage::Rotation Rotation;
-                    Rotation.Index = Feature->RotateCmdIndex;
-                    Rotation.Speed = FMath::Abs(Feature->QueuedActuation.Value);
-                    Rotation.Clockwise = Feature->QueuedActuation.Value >= 0;
-                    RotateCmd->Rotations.Add(Rotation);
-                }
-                else if (Feature->ScalarCmdIndex != INDEX_NONE)
-                {
-                    if (!ScalarCmd)
-                    {
-                        ScalarCmd = MakeUnique<FButtplugMessage::ScalarCmd>();
-                        ScalarCmd->DeviceIndex = DeviceIndex;
-                    }
-                    FButtplugMessage::Scalar Scalar;
-                    Scalar.Index = Feature->ScalarCmdIndex;
-                    Scalar.Value = Feature->QueuedActuation.Value;
-                    Scalar.ActuatorType = Buttplug::Private::GetEnumAsString(Feature->FeatureType);
-                    ScalarCmd->Scalars.Add(Scalar);
-                }
+            const int16 Step = Store.QueuedSteps[Row];
+            switch (Store.CmdTypes[Row])
+            {
+            case EButtplugMessageType::LinearCmd:
+            {
+                FButtplugMessage::Vector& Vector = LinearCmd.Vectors.AddDefaulted_GetRef();
+                Vector.Index = Store.CmdIndices[Row];
+                Vector.Duration = FMath::RoundToInt32(Store.QueuedDurations[Row] * 1000); // convert s -> ms
+                Vector.Position = Store.GetStepValue(Row, Step);
+                break;
+            }
+            case EButtplugMessageType::RotateCmd:
+            {
+                FButtplugMessage::Rotation& Rotation = RotateCmd.Rotations.AddDefaulted_GetRef();
+                Rotation.Index = Store.CmdIndices[Row];
+                Rotation.Speed = Store.GetStepValue(Row, FMath::Abs(Step));
+                Rotation.Clockwise = Step >= 0;
+                break;
+            }
+            case EButtplugMessageType::ScalarCmd:
+            {
+                FButtplugMessage::Scalar& Scalar = ScalarCmd.Scalars.AddDefaulted_GetRef();
+                Scalar.Index = Store.CmdIndices[Row];
+                Scalar.Value = Store.GetStepValue(Row, Step);
+                Scalar.ActuatorType = Store.FeatureTypes[Row];
+                break;
+            }
+            default:
+                break;
             }
         }
 
-        if (LinearCmd) GetSubsystem()->EnqueueMessage(MoveTemp(LinearCmd));
-        if (RotateCmd) GetSubsystem()->EnqueueMessage(MoveTemp(RotateCmd));
-        if (ScalarCmd) GetSubsystem()->EnqueueMessage(MoveTemp(ScalarCmd));
+        bSentMessage |= !LinearCmd.Vectors.IsEmpty() || !RotateCmd.Rotations.IsEmpty() || !ScalarCmd.Scalars.IsEmpty();
+        if (!LinearCmd.Vectors.IsEmpty()) GetSubsystem()->BufferMessage(MoveTemp(LinearCmd));
+        if (!RotateCmd.Rotations.IsEmpty()) GetSubsystem()->BufferMessage(MoveTemp(RotateCmd));
+        if (!ScalarCmd.Scalars.IsEmpty()) GetSubsystem()->BufferMessage(MoveTemp(ScalarCmd));
+    }
+
+    for (FButtplugMessageVariant& Cmd : MessageQueue)
+    {
+        GetSubsystem()->BufferMessage(MoveTemp(Cmd));
     }
+    MessageQueue.Reset();
 
-    for (TUniquePtr<FButtplugMessage>& Cmd : MessageQueue)
+    if (bSentMessage)
     {
-        GetSubsystem()->EnqueueMessage(MoveTemp(Cmd));
+        // Start the gap until this device can be sent to again.
+        TimeSinceLastMessage = 0.0f;
     }
-    MessageQueue.Empty();
 }
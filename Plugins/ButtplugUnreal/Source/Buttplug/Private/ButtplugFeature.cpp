@@ -4,9 +4,12 @@
 
 #include "ButtplugConversions.h"
 #include "ButtplugDevice.h"
+#include "ButtplugFeatureStore.h"
 #include "ButtplugMessage.h"
+#include "ButtplugSettings.h"
 #include "ButtplugSubsystem.h"
 #include "LatentActions.h"
+#include "Logging/StructuredLog.h"
 
 class UButtplugFeature::FLatentSensorAction : public FPendingLatentAction
 {
@@ -14,13 +17,15 @@ private:
 	friend class UButtplugFeature;
 
 public:
-	FLatentSensorAction(const FLatentActionInfo& LatentInfo, TObjectPtr<UButtplugFeature> Feature, TArray<int32>& OutReading)
+	FLatentSensorAction(const FLatentActionInfo& LatentInfo, TObjectPtr<UButtplugFeature> Feature, EButtplugSensorReadResult& OutResult, TArray<int32>& OutReading, FString& OutErrorMessage)
 		: FPendingLatentAction()
 		, ExecutionFunction(LatentInfo.ExecutionFunction)
 		, LinkID(LatentInfo.Linkage)
 		, CallbackTarget(LatentInfo.CallbackTarget)
 		, OwningFeature(Feature)
+		, Result(OutResult)
 		, Reading(OutReading)
+		, ErrorMessage(OutErrorMessage)
 	{
 	}
 
@@ -54,27 +59,41 @@ private:
 	int32 LinkID = INDEX_NONE;
 	FWeakObjectPtr CallbackTarget;
 	TObjectPtr<UButtplugFeature> OwningFeature;
+	EButtplugSensorReadResult& Result;
 	TArray<int32>& Reading;
+	FString& ErrorMessage;
 };
 
 bool UButtplugFeature::IsActuator() const
 {
-	return ScalarCmdIndex != INDEX_NONE || RotateCmdIndex != INDEX_NONE || LinearCmdIndex != INDEX_NONE;
+	return StoreRow != INDEX_NONE && GetDevice()->GetFeatureStore().IsActuator(StoreRow);
 }
 
 bool UButtplugFeature::IsSensor() const
 {
-	return SensorReadCmdIndex != INDEX_NONE || SensorSubscribeCmdIndex != INDEX_NONE;
+	return HasCmdType(EButtplugMessageType::SensorReadCmd) || HasCmdType(EButtplugMessageType::SensorSubscribeCmd);
 }
 
 bool UButtplugFeature::CanRead() const
 {
-	return SensorReadCmdIndex != INDEX_NONE;
+	return HasCmdType(EButtplugMessageType::SensorReadCmd);
 }
 
 bool UButtplugFeature::CanSubscribe() const
 {
-	return SensorSubscribeCmdIndex != INDEX_NONE;
+	return HasCmdType(EButtplugMessageType::SensorSubscribeCmd);
+}
+
+bool UButtplugFeature::HasCmdType(EButtplugMessageType CmdType) const
+{
+	// The command description is only written on the game thread, so reading it there doesn't need HapticsLock.
+	return StoreRow != INDEX_NONE && GetDevice()->GetFeatureStore().CmdTypes[StoreRow] == CmdType;
+}
+
+uint32 UButtplugFeature::GetCmdIndex() const
+{
+	check(StoreRow != INDEX_NONE);
+	return GetDevice()->GetFeatureStore().CmdIndices[StoreRow];
 }
 
 int32 UButtplugFeature::GetActuatorStepCount() const
@@ -87,14 +106,41 @@ const TArray<FInt32Interval>& UButtplugFeature::GetSensorRange() const
 	return SensorRange;
 }
 
+const FButtplugResponseCurve& UButtplugFeature::GetResponseCurve() const
+{
+	return ResponseCurve;
+}
+
+void UButtplugFeature::SetResponseCurve(const FButtplugResponseCurve& Curve)
+{
+	ResponseCurve = Curve;
+	if (StoreRow == INDEX_NONE || !IsActuator()) return;
+
+	TArray<uint16> ResponseTable = MakeResponseTable();
+	UButtplugDevice* Device = GetDevice();
+	FScopeLock Lock(&Device->GetSubsystem()->GetHapticsLock());
+	Device->GetFeatureStore().SetResponseTable(StoreRow, MoveTemp(ResponseTable));
+}
+
+float UButtplugFeature::GetPollRate() const
+{
+	return PollRate;
+}
+
+void UButtplugFeature::SetPollRate(float Rate)
+{
+	PollRate = FMath::Max(Rate, 0.0f);
+	if (PollRate > 0 && CanRead())
+	{
+		GetDevice()->GetSubsystem()->SchedulePoll(this);
+	}
+}
+
 void UButtplugFeature::Actuate(double Value, float Duration)
 {
 	if (IsActuator())
 	{
-		QueuedActuation.Duration = Duration;
-		QueuedActuation.Value = Value;
-		bHasQueuedActuation = true;
-		GetWorld()->GetTimerManager().SetTimer(ResetTimer, this, &ThisClass::Stop, Duration);
+		GetDevice()->GetSubsystem()->Actuate(GetHandle(), Value, Duration);
 	}
 }
 
@@ -107,13 +153,33 @@ void UButtplugFeature::Subscribe()
 {
 	if (CanSubscribe())
 	{
-		EnqueueSubscribeCmd();
+		++SubscriptionCount;
+		UpdateSubscription();
 	}
 }
 
 void UButtplugFeature::Unsubscribe()
 {
-	if (CanSubscribe())
+	if (CanSubscribe() && SubscriptionCount > 0)
+	{
+		--SubscriptionCount;
+		UpdateSubscription();
+	}
+}
+
+void UButtplugFeature::UpdateSubscription()
+{
+	if (!CanSubscribe() || !GetDevice()->IsConnected()) return;
+
+	// Listening to OnSensorReading counts as a subscription, so that readings nobody wants aren't streamed.
+	bool bWanted = SubscriptionCount > 0 || OnSensorReading.IsBound();
+	if (bWanted == bServerSubscribed) return;
+	bServerSubscribed = bWanted;
+	if (bWanted)
+	{
+		EnqueueSubscribeCmd();
+	}
+	else
 	{
 		EnqueueUnsubscribeCmd();
 	}
@@ -124,72 +190,124 @@ const TArray<int32>& UButtplugFeature::GetLastSensorReading() const
 	return LastSensorReading;
 }
 
-void UButtplugFeature::AsyncRead(FLatentActionInfo LatentInfo, TArray<int32>& Reading)
+double UButtplugFeature::GetSensorAverage(int32 Channel) const
+{
+	return SensorHistory.GetAverage(Channel);
+}
+
+int32 UButtplugFeature::GetSensorMin(int32 Channel) const
+{
+	return SensorHistory.GetMin(Channel);
+}
+
+int32 UButtplugFeature::GetSensorMax(int32 Channel) const
+{
+	return SensorHistory.GetMax(Channel);
+}
+
+double UButtplugFeature::GetSensorRateOfChange(int32 Channel) const
+{
+	return SensorHistory.GetRateOfChange(Channel);
+}
+
+void UButtplugFeature::AsyncRead(FLatentActionInfo LatentInfo, EButtplugSensorReadResult& Result, TArray<int32>& Reading, FString& ErrorMessage)
 {
 	FLatentActionManager& LatentActionManager = GetWorld()->GetLatentActionManager();
 	if (!LatentActionManager.FindExistingAction<FLatentSensorAction>(LatentInfo.CallbackTarget, LatentInfo.UUID))
 	{
-		FLatentSensorAction* Action = new FLatentSensorAction(LatentInfo, this, Reading);
+		FLatentSensorAction* Action = new FLatentSensorAction(LatentInfo, this, Result, Reading, ErrorMessage);
 		LatentActionManager.AddNewAction(LatentInfo.CallbackTarget, LatentInfo.UUID, Action);
 		LatentSensorActions.Add(Action);
-		
-		if (LatentSensorActions.Num() == 1)
-		{
-			Read();
-		}
+		Read();
 	}
 }
 
 void UButtplugFeature::Read()
 {
-	if (CanRead())
+	if (!CanRead())
 	{
-		EnqueueReadCmd();
+		FailRead(TEXT("sensor can't be read"));
 	}
-	else
+	else if (!GetDevice()->IsConnected())
+	{
+		FailRead(TEXT("device isn't connected"));
+	}
+	else if (PendingReadId == 0)
 	{
-		SetSensorReading({});
+		PendingReadId = EnqueueReadCmd();
 	}
 }
 
-void UButtplugFeature::EnqueueReadCmd() const
+uint32 UButtplugFeature::EnqueueReadCmd()
 {
 	UButtplugDevice* Device = GetDevice();
-	TUniquePtr<FButtplugMessage::SensorReadCmd> ReadCmd = MakeUnique<FButtplugMessage::SensorReadCmd>();
-	ReadCmd->DeviceIndex = Device->DeviceIndex;
-	ReadCmd->SensorIndex = SensorReadCmdIndex;
-	ReadCmd->SensorType = Buttplug::Private::GetEnumAsString(FeatureType);
-	Device->MessageQueue.Add(MoveTemp(ReadCmd));
+	UButtplugSubsystem* Subsystem = Device->GetSubsystem();
+	FScopeLock Lock(&Subsystem->GetHapticsLock());
+	FButtplugMessage::SensorReadCmd& ReadCmd = Device->MessageQueue.Emplace_GetRef(TInPlaceType<FButtplugMessage::SensorReadCmd>()).Get<FButtplugMessage::SensorReadCmd>();
+	ReadCmd.DeviceIndex = Device->DeviceIndex;
+	ReadCmd.SensorIndex = GetCmdIndex();
+	ReadCmd.SensorType = FeatureType;
+	// Numbered now rather than when the device's send interval lets it go, so that its reply and failure can be matched to it.
+	ReadCmd.Id = Subsystem->NextMessageId.fetch_add(1, std::memory_order_relaxed);
+	// Only one read is in flight at a time, so a failure is always for the pending one.
+	Subsystem->SetMessageFailedCallback(ReadCmd.Id, [WeakThis = TWeakObjectPtr<UButtplugFeature>(this)](const FString& Reason)
+	{
+		if (UButtplugFeature* Feature = WeakThis.Get())
+		{
+			Feature->FailRead(Reason);
+		}
+	});
+	return ReadCmd.Id;
 }
 
 void UButtplugFeature::EnqueueSubscribeCmd() const
 {
 	UButtplugDevice* Device = GetDevice();
-	TUniquePtr<FButtplugMessage::SensorSubscribeCmd> SubscribeCmd = MakeUnique<FButtplugMessage::SensorSubscribeCmd>();
-	SubscribeCmd->DeviceIndex = Device->DeviceIndex;
-	SubscribeCmd->SensorIndex = SensorReadCmdIndex;
-	SubscribeCmd->SensorType = Buttplug::Private::GetEnumAsString(FeatureType);
-	Device->MessageQueue.Add(MoveTemp(SubscribeCmd));
+	FScopeLock Lock(&Device->GetSubsystem()->GetHapticsLock());
+	FButtplugMessage::SensorSubscribeCmd& SubscribeCmd = Device->MessageQueue.Emplace_GetRef(TInPlaceType<FButtplugMessage::SensorSubscribeCmd>()).Get<FButtplugMessage::SensorSubscribeCmd>();
+	SubscribeCmd.DeviceIndex = Device->DeviceIndex;
+	SubscribeCmd.SensorIndex = GetCmdIndex();
+	SubscribeCmd.SensorType = FeatureType;
 }
 
 void UButtplugFeature::EnqueueUnsubscribeCmd() const
 {
 	UButtplugDevice* Device = GetDevice();
-	TUniquePtr<FButtplugMessage::SensorUnsubscribeCmd> UnsubscribeCmd = MakeUnique<FButtplugMessage::SensorUnsubscribeCmd>();
-	UnsubscribeCmd->DeviceIndex = Device->DeviceIndex;
-	UnsubscribeCmd->SensorIndex = SensorReadCmdIndex;
-	UnsubscribeCmd->SensorType = Buttplug::Private::GetEnumAsString(FeatureType);
-	Device->MessageQueue.Add(MoveTemp(UnsubscribeCmd));
+	FScopeLock Lock(&Device->GetSubsystem()->GetHapticsLock());
+	FButtplugMessage::SensorUnsubscribeCmd& UnsubscribeCmd = Device->MessageQueue.Emplace_GetRef(TInPlaceType<FButtplugMessage::SensorUnsubscribeCmd>()).Get<FButtplugMessage::SensorUnsubscribeCmd>();
+	UnsubscribeCmd.DeviceIndex = Device->DeviceIndex;
+	UnsubscribeCmd.SensorIndex = GetCmdIndex();
+	UnsubscribeCmd.SensorType = FeatureType;
+}
+
+void UButtplugFeature::SetSensorReading(TArrayView<const int32> Reading)
+{
+	LastSensorReading.Reset();
+	LastSensorReading.Append(Reading.GetData(), Reading.Num());
+	if (!Reading.IsEmpty())
+	{
+		if (SensorHistory.GetNumChannels() != Reading.Num())
+		{
+			SensorHistory.Init(GetDefault<UButtplugSettings>()->SensorHistoryCapacity, Reading.Num());
+		}
+		SensorHistory.Add(Reading, FPlatformTime::Seconds());
+	}
+	// Broadcasting a dynamic delegate copies the reading, so skip it for high rate sensors nobody is listening to.
+	if (OnSensorReading.IsBound())
+	{
+		OnSensorReading.Broadcast(LastSensorReading);
+	}
 }
 
-void UButtplugFeature::SetSensorReading(const TArray<int32>& Reading)
+void UButtplugFeature::CompleteRead(TArrayView<const int32> Reading)
 {
-	LastSensorReading = Reading;
-	OnSensorReading.Broadcast(LastSensorReading);
+	PendingReadId = 0;
+	SetSensorReading(Reading);
 	for (FLatentSensorAction* Action : LatentSensorActions)
 	{
 		if (Action)
 		{
+			Action->Result = EButtplugSensorReadResult::Succeeded;
 			Action->Reading = LastSensorReading;
 			Action->bReady = true;
 		}
@@ -197,6 +315,46 @@ void UButtplugFeature::SetSensorReading(const TArray<int32>& Reading)
 	LatentSensorActions.Empty();
 }
 
+void UButtplugFeature::FailRead(const FString& Reason)
+{
+	UE_LOGFMT(LogButtplug, Verbose, "Failed to read Buttplug sensor {Feature}: {Reason}", FeatureDescriptor, Reason);
+	PendingReadId = 0;
+	for (FLatentSensorAction* Action : LatentSensorActions)
+	{
+		if (Action)
+		{
+			Action->Result = EButtplugSensorReadResult::Failed;
+			Action->ErrorMessage = Reason;
+			Action->bReady = true;
+		}
+	}
+	LatentSensorActions.Empty();
+}
+
+int32 UButtplugFeature::GetStepGrid() const
+{
+	// Devices which don't report a step count still get a grid, so that float noise doesn't count as a change.
+	constexpr int32 DefaultStepCount = 1000;
+	return ActuatorStepCount > 0 ? FMath::Min(ActuatorStepCount, int32(MAX_int16)) : DefaultStepCount;
+}
+
+TArray<uint16> UButtplugFeature::MakeResponseTable() const
+{
+	TArray<uint16> ResponseTable;
+	if (ResponseCurve.IsIdentity()) return ResponseTable;
+
+	int32 Grid = GetStepGrid();
+	ResponseTable.SetNumUninitialized(Grid + 1);
+	ResponseTable[0] = 0; // Off stays off, whatever the threshold.
+	for (int32 Input = 1; Input <= Grid; ++Input)
+	{
+		double Curved = FMath::Pow(Input / double(Grid), double(ResponseCurve.Gamma));
+		double Output = FMath::Lerp(double(ResponseCurve.MinThreshold), double(ResponseCurve.MaxCap), Curved);
+		ResponseTable[Input] = static_cast<uint16>(FMath::Clamp(FMath::RoundToInt32(Output * Grid), 0, Grid));
+	}
+	return ResponseTable;
+}
+
 UButtplugDevice* UButtplugFeature::GetDevice() const
 {
 	return Cast<UButtplugDevice>(GetOuter());
@@ -0,0 +1,207 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugFeatureStore.h"
+
+int32 FButtplugFeatureStore::AddDevice(uint32 DeviceIndex, int32 NumFeatures)
+{
+	int32 Slot = FreeSlots.IsEmpty() ? DeviceSlots.AddDefaulted() : FreeSlots.Pop(false);
+	FDeviceSlot& DeviceSlot = DeviceSlots[Slot];
+	DeviceSlot.DeviceIndex = DeviceIndex;
+	DeviceSlot.NumRows = NumFeatures;
+	DeviceSlot.Generation = NextGeneration++;
+	DeviceSlot.bConnected = false;
+
+	// First fit, taking rows from the front of the freed range. The server replacing a device usually
+	// replaces it with one of the same shape, so ranges are rarely split.
+	int32 FreeIndex = FreeRows.IndexOfByPredicate([NumFeatures](const FInt32Interval& Range) { return Range.Size() >= NumFeatures; });
+	if (NumFeatures > 0 && FreeIndex != INDEX_NONE)
+	{
+		FInt32Interval& Range = FreeRows[FreeIndex];
+		DeviceSlot.FirstRow = Range.Min;
+		Range.Min += NumFeatures;
+		if (Range.Size() == 0)
+		{
+			FreeRows.RemoveAtSwap(FreeIndex, 1, false);
+		}
+		ResetRows(DeviceSlot.FirstRow, NumFeatures, Slot);
+		return Slot;
+	}
+
+	DeviceSlot.FirstRow = Num();
+	RowSlots.AddUninitialized(NumFeatures);
+	CmdTypes.AddUninitialized(NumFeatures);
+	CmdIndices.AddUninitialized(NumFeatures);
+	FeatureTypes.AddUninitialized(NumFeatures);
+	StepGrids.AddUninitialized(NumFeatures);
+	ResponseTables.AddDefaulted(NumFeatures);
+	QueuedSteps.AddUninitialized(NumFeatures);
+	QueuedDurations.AddUninitialized(NumFeatures);
+	Dirty.Add(false, NumFeatures);
+	LastSentSteps.AddUninitialized(NumFeatures);
+	LastSentTimes.AddUninitialized(NumFeatures);
+	ResetRows(DeviceSlot.FirstRow, NumFeatures, Slot);
+	return Slot;
+}
+
+void FButtplugFeatureStore::RetireDevice(int32 Slot)
+{
+	FDeviceSlot& DeviceSlot = DeviceSlots[Slot];
+	DeviceSlot.Generation = NextGeneration++;
+	DeviceSlot.bConnected = false;
+	for (int32 Row = DeviceSlot.FirstRow; Row < DeviceSlot.FirstRow + DeviceSlot.NumRows; ++Row)
+	{
+		Dirty[Row] = false;
+		Deadlines.Cancel(Row);
+	}
+
+	if (DeviceSlot.NumRows > 0)
+	{
+		// Max is one past the last row, so that Size is the number of rows.
+		FreeRows.Add(FInt32Interval(DeviceSlot.FirstRow, DeviceSlot.FirstRow + DeviceSlot.NumRows));
+	}
+	DeviceSlot.NumRows = 0;
+	FreeSlots.Add(Slot);
+}
+
+void FButtplugFeatureStore::ResetRows(int32 FirstRow, int32 NumRows, int32 Slot)
+{
+	for (int32 Row = FirstRow; Row < FirstRow + NumRows; ++Row)
+	{
+		RowSlots[Row] = Slot;
+		CmdTypes[Row] = {};
+		CmdIndices[Row] = 0;
+		FeatureTypes[Row] = {};
+		StepGrids[Row] = 1;
+		ResponseTables[Row].Reset();
+		QueuedSteps[Row] = 0;
+		QueuedDurations[Row] = 0.0f;
+		Dirty[Row] = false;
+		LastSentSteps[Row] = UnknownStep;
+		LastSentTimes[Row] = 0.0;
+	}
+}
+
+void FButtplugFeatureStore::SetConnected(int32 Slot, bool bConnected)
+{
+	FDeviceSlot& DeviceSlot = DeviceSlots[Slot];
+	DeviceSlot.bConnected = bConnected;
+	for (int32 Row = DeviceSlot.FirstRow; Row < DeviceSlot.FirstRow + DeviceSlot.NumRows; ++Row)
+	{
+		LastSentSteps[Row] = UnknownStep;
+		Deadlines.Cancel(Row);
+	}
+}
+
+void FButtplugFeatureStore::SetCommand(int32 Row, EButtplugMessageType CmdType, uint32 CmdIndex, EButtplugFeatureType FeatureType, int32 StepGrid)
+{
+	CmdTypes[Row] = CmdType;
+	CmdIndices[Row] = CmdIndex;
+	FeatureTypes[Row] = FeatureType;
+	StepGrids[Row] = StepGrid;
+}
+
+void FButtplugFeatureStore::SetResponseTable(int32 Row, TArray<uint16>&& Table)
+{
+	check(Table.IsEmpty() || Table.Num() == StepGrids[Row] + 1);
+	ResponseTables[Row] = MoveTemp(Table);
+}
+
+FButtplugDeviceHandle FButtplugFeatureStore::GetDeviceHandle(int32 Slot) const
+{
+	if (!DeviceSlots.IsValidIndex(Slot)) return {};
+	return { Slot, DeviceSlots[Slot].Generation };
+}
+
+FButtplugFeatureHandle FButtplugFeatureStore::GetFeatureHandle(int32 Row) const
+{
+	if (!RowSlots.IsValidIndex(Row)) return {};
+	return { Row, DeviceSlots[RowSlots[Row]].Generation };
+}
+
+bool FButtplugFeatureStore::IsValid(FButtplugDeviceHandle Handle) const
+{
+	return DeviceSlots.IsValidIndex(Handle.Slot) && DeviceSlots[Handle.Slot].Generation == Handle.Generation;
+}
+
+bool FButtplugFeatureStore::IsValid(FButtplugFeatureHandle Handle) const
+{
+	return RowSlots.IsValidIndex(Handle.Row) && DeviceSlots[RowSlots[Handle.Row]].Generation == Handle.Generation;
+}
+
+bool FButtplugFeatureStore::IsActuatorCmd(EButtplugMessageType CmdType)
+{
+	return CmdType == EButtplugMessageType::ScalarCmd || CmdType == EButtplugMessageType::LinearCmd || CmdType == EButtplugMessageType::RotateCmd;
+}
+
+int16 FButtplugFeatureStore::Quantize(int32 Row, double Value) const
+{
+	int32 Grid = StepGrids[Row];
+	int32 Input = FMath::RoundToInt32(FMath::Clamp(FMath::Abs(Value), 0.0, 1.0) * Grid);
+	const TArray<uint16>& ResponseTable = ResponseTables[Row];
+	int32 Step = ResponseTable.IsEmpty() ? Input : ResponseTable[Input];
+	return static_cast<int16>(Value < 0 ? -Step : Step);
+}
+
+void FButtplugFeatureStore::Queue(int32 Row, int16 Step, float Duration, double Now)
+{
+	QueuedSteps[Row] = Step;
+	QueuedDurations[Row] = Duration;
+	Dirty[Row] = true;
+
+	// As with FTimerManager::SetTimer, a duration that isn't positive (or finite) means no deadline.
+	if (Duration > 0 && FMath::IsFinite(Duration))
+	{
+		Deadlines.Schedule(Row, Now + Duration, Now);
+	}
+	else
+	{
+		Deadlines.Cancel(Row);
+	}
+}
+
+void FButtplugFeatureStore::CancelQueued(int32 Slot)
+{
+	const FDeviceSlot& DeviceSlot = DeviceSlots[Slot];
+	for (int32 Row = DeviceSlot.FirstRow; Row < DeviceSlot.FirstRow + DeviceSlot.NumRows; ++Row)
+	{
+		if (!IsActuator(Row)) continue;
+		QueuedSteps[Row] = 0;
+		QueuedDurations[Row] = 0.0f;
+		LastSentSteps[Row] = 0;
+		Deadlines.Cancel(Row);
+	}
+	Dirty.SetRange(DeviceSlot.FirstRow, DeviceSlot.NumRows, false);
+}
+
+void FButtplugFeatureStore::ExpireDeadlines(double Now)
+{
+	if (Deadlines.IsEmpty()) return;
+
+	ExpiredRows.Reset();
+	Deadlines.Advance(Now, ExpiredRows);
+	for (int32 Row : ExpiredRows)
+	{
+		// Merged into the device's next actuation command, like any other queued actuation.
+		QueuedSteps[Row] = 0;
+		QueuedDurations[Row] = 0.0f;
+		Dirty[Row] = true;
+	}
+}
+
+bool FButtplugFeatureStore::Consume(int32 Row, double Now, float KeepAliveInterval)
+{
+	bool bQueued = Dirty[Row];
+	int32 LastSentStep = LastSentSteps[Row];
+	if (!bQueued && LastSentStep == UnknownStep) return false;
+	Dirty[Row] = false;
+
+	int32 Step = QueuedSteps[Row];
+	bool bChanged = LastSentStep != Step;
+	// Only keep active actuation alive; a stopped actuator stays stopped.
+	bool bKeepAlive = KeepAliveInterval > 0 && Step != 0 && Now - LastSentTimes[Row] >= KeepAliveInterval;
+	if (!(bQueued && bChanged) && !bKeepAlive) return false;
+
+	LastSentSteps[Row] = Step;
+	LastSentTimes[Row] = Now;
+	return true;
+}
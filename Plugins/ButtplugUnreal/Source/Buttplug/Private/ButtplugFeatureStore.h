@@ -0,0 +1,104 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "ButtplugHandle.h"
+#include "ButtplugMessage.h"
+#include "ButtplugTimingWheel.h"
+
+/// Command description and actuation state of every feature of every device, one row per feature, stored as parallel arrays.
+/// Each device's features are a contiguous range of rows in a device slot, so flushing a device is a linear pass over
+/// packed memory rather than a visit to each UButtplugFeature. Slots and rows are what native handles index.
+/// Not thread safe; guarded by the subsystem's haptics lock.
+class FButtplugFeatureStore
+{
+public:
+	/// Marks a row that hasn't sent anything since (re)connecting.
+	static constexpr int32 UnknownStep = MIN_int32;
+
+	struct FDeviceSlot
+	{
+		uint32 DeviceIndex = 0;
+		int32 FirstRow = 0;
+		int32 NumRows = 0;
+		/// Changed when the server replaces the device and when the slot is reused, so that handles to it and its features go stale.
+		/// Drawn from a counter shared by every slot, so that a row reused by another slot can't match an old handle.
+		uint32 Generation = 0;
+		bool bConnected = false;
+	};
+
+	/// Add a device slot with a row for each of its features, reusing retired slots and rows where they fit.
+	/// @return The new slot.
+	int32 AddDevice(uint32 DeviceIndex, int32 NumFeatures);
+	/// Invalidate handles to a slot and its rows, because the server replaced its device, and free them for reuse.
+	void RetireDevice(int32 Slot);
+	/// Forget what was last sent to a device, and its deadlines, since it may not be doing that anymore.
+	void SetConnected(int32 Slot, bool bConnected);
+	/// Describe the command a row's feature is sent with.
+	void SetCommand(int32 Row, EButtplugMessageType CmdType, uint32 CmdIndex, EButtplugFeatureType FeatureType, int32 StepGrid);
+	/// Set the response curve of an actuator row, sampled at each input step. Empty for the identity curve.
+	void SetResponseTable(int32 Row, TArray<uint16>&& Table);
+
+	FButtplugDeviceHandle GetDeviceHandle(int32 Slot) const;
+	FButtplugFeatureHandle GetFeatureHandle(int32 Row) const;
+	bool IsValid(FButtplugDeviceHandle Handle) const;
+	bool IsValid(FButtplugFeatureHandle Handle) const;
+	bool IsActuator(int32 Row) const { return IsActuatorCmd(CmdTypes[Row]); }
+	static bool IsActuatorCmd(EButtplugMessageType CmdType);
+
+	/// Apply a row's response curve to an actuation value and snap it to its step grid.
+	int16 Quantize(int32 Row, double Value) const;
+	/// Queue a step to send to a row, replacing any queued step.
+	/// @param Duration If > 0 and finite, the row is stopped again once it has passed.
+	void Queue(int32 Row, int16 Step, float Duration, double Now);
+	/// Forget queued actuation and deadlines for a device, recording its actuators as stopped, because a stop command is being sent.
+	void CancelQueued(int32 Slot);
+	/// Queue a stop for every row whose actuation deadline has passed.
+	void ExpireDeadlines(double Now);
+	/// Consume a row's queued actuation, deciding whether it needs sending.
+	/// Actuation that matches the last sent step is suppressed, unless KeepAliveInterval has passed since it was sent.
+	bool Consume(int32 Row, double Now, float KeepAliveInterval);
+	/// The actuation value sent for a step of a row.
+	double GetStepValue(int32 Row, int16 Step) const { return Step / double(StepGrids[Row]); }
+
+	int32 Num() const { return QueuedSteps.Num(); }
+
+	TArray<FDeviceSlot> DeviceSlots;
+
+	// Command description, fixed once the device is added.
+	/// The device slot each row belongs to.
+	TArray<int32> RowSlots;
+	/// The command the row's feature is listed under in its device message attributes.
+	TArray<EButtplugMessageType> CmdTypes;
+	TArray<uint32> CmdIndices;
+	TArray<EButtplugFeatureType> FeatureTypes;
+	TArray<int32> StepGrids;
+	TArray<TArray<uint16>> ResponseTables;
+
+	// Actuation state.
+	/// Target on the step grid, after the response curve. Negative for counterclockwise rotation.
+	TArray<int16> QueuedSteps;
+	TArray<float> QueuedDurations;
+	/// Set for rows with queued actuation not yet consumed.
+	TBitArray<> Dirty;
+	/// The step most recently sent, or UnknownStep.
+	TArray<int32> LastSentSteps;
+	/// FPlatformTime::Seconds when LastSentSteps was sent.
+	TArray<double> LastSentTimes;
+
+private:
+	/// Put a range of rows back to how a new row starts out, owned by Slot.
+	void ResetRows(int32 FirstRow, int32 NumRows, int32 Slot);
+
+	/// Retired slots, and ranges of rows freed by them, for AddDevice to reuse.
+	TArray<int32> FreeSlots;
+	TArray<FInt32Interval> FreeRows;
+	uint32 NextGeneration = 1;
+
+	/// When each timed actuation ends, keyed by row.
+	FButtplugTimingWheel Deadlines;
+	TArray<int32> ExpiredRows;
+};
@@ -0,0 +1,90 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugHapticsClock.h"
+
+#include "HAL/RunnableThread.h"
+#include "Misc/ScopeLock.h"
+
+FButtplugHapticsClock::FButtplugHapticsClock(double Rate, FTickFunction&& InTickFunction)
+	: Period(1.0 / Rate)
+	, TickFunction(MoveTemp(InTickFunction))
+{
+	check(Rate > 0.0);
+	Thread = FRunnableThread::Create(this, TEXT("ButtplugHapticsClock"), 0, TPri_AboveNormal);
+}
+
+FButtplugHapticsClock::~FButtplugHapticsClock()
+{
+	if (Thread)
+	{
+		Thread->Kill(/*bShouldWait:*/true);
+		delete Thread;
+	}
+}
+
+FButtplugHapticsClockStats FButtplugHapticsClock::GetStats() const
+{
+	FScopeLock Lock(&StatsLock);
+	return Stats;
+}
+
+uint32 FButtplugHapticsClock::Run()
+{
+	double LastTickTime = FPlatformTime::Seconds();
+	double NextTickTime = LastTickTime + Period;
+	while (!bStopping.load(std::memory_order_relaxed))
+	{
+		WaitUntil(NextTickTime);
+		double TickTime = FPlatformTime::Seconds();
+		TickFunction(static_cast<float>(TickTime - LastTickTime));
+		LastTickTime = TickTime;
+
+		// Keep to the original schedule rather than drifting by each tick's lateness,
+		// but don't try to catch up on ticks that were missed entirely (e.g. while the process was suspended).
+		double Lateness = TickTime - NextTickTime;
+		NextTickTime += Period;
+		int64 MissedTicks = 0;
+		double Now = FPlatformTime::Seconds();
+		if (Now > NextTickTime)
+		{
+			MissedTicks = FMath::FloorToInt64((Now - NextTickTime) / Period) + 1;
+			NextTickTime += MissedTicks * Period;
+		}
+		RecordTick(Lateness, MissedTicks);
+	}
+	return 0;
+}
+
+void FButtplugHapticsClock::Stop()
+{
+	bStopping.store(true, std::memory_order_relaxed);
+}
+
+void FButtplugHapticsClock::WaitUntil(double Time)
+{
+	// OS sleeps can overshoot by a scheduler quantum, so only sleep until close to the deadline and spin the rest.
+	constexpr double SpinTime = 0.002;
+	for (;;)
+	{
+		double Remaining = Time - FPlatformTime::Seconds();
+		if (Remaining <= 0.0) return;
+		if (Remaining > SpinTime)
+		{
+			FPlatformProcess::SleepNoStats(static_cast<float>(Remaining - SpinTime));
+		}
+		else
+		{
+			FPlatformProcess::YieldThread();
+		}
+	}
+}
+
+void FButtplugHapticsClock::RecordTick(double Lateness, int64 MissedTicks)
+{
+	FScopeLock Lock(&StatsLock);
+	++Stats.TickCount;
+	Stats.MissedTickCount += MissedTicks;
+	TotalLateness += Lateness;
+	Stats.MeanJitter = static_cast<float>(TotalLateness / Stats.TickCount * 1000.0); // convert s -> ms
+	Stats.MaxJitter = FMath::Max(Stats.MaxJitter, static_cast<float>(Lateness * 1000.0));
+}
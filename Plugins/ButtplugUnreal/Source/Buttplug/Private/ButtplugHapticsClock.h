@@ -0,0 +1,47 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "ButtplugSubsystem.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+
+/// Calls a tick function at a fixed rate on its own thread, independent of the game frame rate and pause state.
+/// Waits by sleeping until shortly before each tick and then spinning, for sub-millisecond pacing.
+class FButtplugHapticsClock : public FRunnable
+{
+public:
+	using FTickFunction = TFunction<void(float DeltaTime)>;
+
+	/// @param Rate Ticks per second.
+	/// @param InTickFunction Called from the clock thread every tick, with the time since the previous tick.
+	FButtplugHapticsClock(double Rate, FTickFunction&& InTickFunction);
+	/// Stops and joins the clock thread.
+	virtual ~FButtplugHapticsClock() override;
+
+	/// Pacing statistics since the clock started. Safe to call from any thread.
+	FButtplugHapticsClockStats GetStats() const;
+
+	// FRunnable implementation
+public:
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	static void WaitUntil(double Time);
+	void RecordTick(double Lateness, int64 MissedTicks);
+
+private:
+	const double Period;
+	FTickFunction TickFunction;
+	FRunnableThread* Thread = nullptr;
+	std::atomic<bool> bStopping = false;
+
+	mutable FCriticalSection StatsLock;
+	FButtplugHapticsClockStats Stats;
+	double TotalLateness = 0.0;
+};
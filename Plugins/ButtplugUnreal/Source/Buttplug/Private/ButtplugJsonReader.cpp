@@ -0,0 +1,202 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugJsonReader.h"
+
+#include "Misc/Parse.h"
+
+void FButtplugJsonReader::SkipWhitespace()
+{
+	while (Cursor < End && (*Cursor == TEXT(' ') || *Cursor == TEXT('\t') || *Cursor == TEXT('\n') || *Cursor == TEXT('\r')))
+	{
+		++Cursor;
+	}
+}
+
+bool FButtplugJsonReader::TryConsume(TCHAR Token)
+{
+	SkipWhitespace();
+	if (Cursor < End && *Cursor == Token)
+	{
+		++Cursor;
+		return true;
+	}
+	return false;
+}
+
+bool FButtplugJsonReader::IsAtEnd()
+{
+	SkipWhitespace();
+	return Cursor == End;
+}
+
+bool FButtplugJsonReader::ReadStringView(FStringView& OutValue)
+{
+	if (!TryConsume(TEXT('"'))) return false;
+	const TCHAR* Start = Cursor;
+	while (Cursor < End && *Cursor != TEXT('"'))
+	{
+		if (*Cursor == TEXT('\\')) return false;
+		++Cursor;
+	}
+	if (Cursor == End) return false;
+	OutValue = FStringView(Start, UE_PTRDIFF_TO_INT32(Cursor - Start));
+	++Cursor;
+	return true;
+}
+
+bool FButtplugJsonReader::ReadValue(FString& OutValue)
+{
+	if (!TryConsume(TEXT('"'))) return false;
+	OutValue.Reset();
+	while (Cursor < End)
+	{
+		// Copy unescaped runs in bulk
+		const TCHAR* Start = Cursor;
+		while (Cursor < End && *Cursor != TEXT('"') && *Cursor != TEXT('\\'))
+		{
+			++Cursor;
+		}
+		OutValue.AppendChars(Start, UE_PTRDIFF_TO_INT32(Cursor - Start));
+		if (Cursor == End) return false;
+
+		if (*Cursor++ == TEXT('"')) return true;
+		if (Cursor == End) return false;
+		switch (*Cursor++)
+		{
+			case TEXT('"'):  OutValue.AppendChar(TEXT('"'));  break;
+			case TEXT('\\'): OutValue.AppendChar(TEXT('\\')); break;
+			case TEXT('/'):  OutValue.AppendChar(TEXT('/'));  break;
+			case TEXT('b'):  OutValue.AppendChar(TEXT('\b')); break;
+			case TEXT('f'):  OutValue.AppendChar(TEXT('\f')); break;
+			case TEXT('n'):  OutValue.AppendChar(TEXT('\n')); break;
+			case TEXT('r'):  OutValue.AppendChar(TEXT('\r')); break;
+			case TEXT('t'):  OutValue.AppendChar(TEXT('\t')); break;
+			case TEXT('u'):
+			{
+				if (End - Cursor < 4) return false;
+				uint32 CodeUnit = 0;
+				for (int32 Digit = 0; Digit < 4; ++Digit)
+				{
+					if (!FChar::IsHexDigit(*Cursor)) return false;
+					CodeUnit = (CodeUnit << 4) | FParse::HexDigit(*Cursor++);
+				}
+				// Surrogate pairs are passed through as-is; TCHAR strings are UTF-16 as well.
+				OutValue.AppendChar(static_cast<TCHAR>(CodeUnit));
+				break;
+			}
+			default: return false;
+		}
+	}
+	return false;
+}
+
+bool FButtplugJsonReader::ReadValue(double& OutValue)
+{
+	SkipWhitespace();
+	const TCHAR* Start = Cursor;
+	while (Cursor < End && (FChar::IsDigit(*Cursor) || *Cursor == TEXT('-') || *Cursor == TEXT('+') || *Cursor == TEXT('.') || *Cursor == TEXT('e') || *Cursor == TEXT('E')))
+	{
+		++Cursor;
+	}
+
+	// The source text isn't guaranteed to be terminated directly after the number, so copy it out for parsing.
+	TCHAR Buffer[64];
+	int32 Len = UE_PTRDIFF_TO_INT32(Cursor - Start);
+	if (Len == 0 || Len >= UE_ARRAY_COUNT(Buffer)) return false;
+	FMemory::Memcpy(Buffer, Start, Len * sizeof(TCHAR));
+	Buffer[Len] = TEXT('\0');
+	OutValue = FCString::Atod(Buffer);
+	return true;
+}
+
+bool FButtplugJsonReader::ReadValue(int64& OutValue)
+{
+	SkipWhitespace();
+	bool bNegative = Cursor < End && *Cursor == TEXT('-');
+	if (bNegative) ++Cursor;
+
+	const TCHAR* Start = Cursor;
+	uint64 Value = 0;
+	while (Cursor < End && FChar::IsDigit(*Cursor))
+	{
+		if (Value > uint64(MAX_int64) / 10) return false;
+		Value = Value * 10 + (*Cursor++ - TEXT('0'));
+	}
+	if (Cursor == Start || Value > uint64(MAX_int64)) return false;
+	// Non-integral numbers fail the read rather than being silently truncated.
+	if (Cursor < End && (*Cursor == TEXT('.') || *Cursor == TEXT('e') || *Cursor == TEXT('E'))) return false;
+
+	OutValue = bNegative ? -int64(Value) : int64(Value);
+	return true;
+}
+
+bool FButtplugJsonReader::ReadValue(int32& OutValue)
+{
+	int64 Value = 0;
+	if (!ReadValue(Value) || Value < MIN_int32 || Value > MAX_int32) return false;
+	OutValue = static_cast<int32>(Value);
+	return true;
+}
+
+bool FButtplugJsonReader::ReadValue(uint32& OutValue)
+{
+	int64 Value = 0;
+	if (!ReadValue(Value) || Value < 0 || Value > MAX_uint32) return false;
+	OutValue = static_cast<uint32>(Value);
+	return true;
+}
+
+bool FButtplugJsonReader::ReadValue(bool& OutValue)
+{
+	SkipWhitespace();
+	if (ReadLiteral(TEXTVIEW("true")))
+	{
+		OutValue = true;
+		return true;
+	}
+	if (ReadLiteral(TEXTVIEW("false")))
+	{
+		OutValue = false;
+		return true;
+	}
+	return false;
+}
+
+bool FButtplugJsonReader::SkipValue()
+{
+	SkipWhitespace();
+	if (Cursor == End) return false;
+	switch (*Cursor)
+	{
+		case TEXT('"'): return SkipString();
+		case TEXT('{'): return ReadObject([this](FStringView) { return SkipValue(); });
+		case TEXT('['): return ReadArray([this]() { return SkipValue(); });
+		case TEXT('n'): return ReadLiteral(TEXTVIEW("null"));
+		case TEXT('t'):
+		case TEXT('f'): { bool Ignored; return ReadValue(Ignored); }
+		default:        { double Ignored; return ReadValue(Ignored); }
+	}
+}
+
+bool FButtplugJsonReader::SkipString()
+{
+	if (!TryConsume(TEXT('"'))) return false;
+	while (Cursor < End)
+	{
+		TCHAR Char = *Cursor++;
+		if (Char == TEXT('"')) return true;
+		if (Char == TEXT('\\') && Cursor < End) ++Cursor;
+	}
+	return false;
+}
+
+bool FButtplugJsonReader::ReadLiteral(FStringView Literal)
+{
+	if (End - Cursor < Literal.Len()) return false;
+	if (FStringView(Cursor, Literal.Len()).Equals(Literal, ESearchCase::CaseSensitive))
+	{
+		Cursor += Literal.Len();
+		return true;
+	}
+	return false;
+}
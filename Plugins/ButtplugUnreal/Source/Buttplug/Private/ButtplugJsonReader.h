@@ -0,0 +1,93 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+/// Single-pass pull tokenizer for decoding Buttplug messages straight from the websocket text.
+/// Unlike FJsonSerializer, this never builds a FJsonValue tree; values are read directly into their destination.
+/// Only JSON as produced by Buttplug servers needs to be handled; anything else (including escaped object keys)
+/// is reported as a failure.
+class FButtplugJsonReader
+{
+public:
+	explicit FButtplugJsonReader(FStringView InJson)
+		: Cursor(InJson.GetData())
+		, End(InJson.GetData() + InJson.Len())
+	{
+	}
+
+	/// Consume the given structural character (one of `[]{}:,"`) if it is next.
+	bool TryConsume(TCHAR Token);
+	/// Has all of the text been consumed (besides trailing whitespace)?
+	bool IsAtEnd();
+	/// Where the reader is in the text, to come back to with Rewind.
+	const TCHAR* GetPosition() const { return Cursor; }
+	/// Return to a position from GetPosition, e.g. to skip a value that failed to read.
+	void Rewind(const TCHAR* Position) { Cursor = Position; }
+
+	/// Read an object, calling Func(FStringView Key) for each member. Func must consume the member value.
+	template<typename FunctionType>
+	bool ReadObject(FunctionType&& Func);
+	/// Read an array, calling Func() for each element. Func must consume the element value.
+	template<typename FunctionType>
+	bool ReadArray(FunctionType&& Func);
+
+	/// Read a string which contains no escape sequences, viewing directly into the source text.
+	bool ReadStringView(FStringView& OutValue);
+	bool ReadValue(FString& OutValue);
+	bool ReadValue(double& OutValue);
+	bool ReadValue(int64& OutValue);
+	bool ReadValue(int32& OutValue);
+	bool ReadValue(uint32& OutValue);
+	bool ReadValue(bool& OutValue);
+	template<typename ElementType, typename AllocatorType>
+	bool ReadValue(TArray<ElementType, AllocatorType>& OutValue);
+
+	/// Consume and discard the next value, whatever it is.
+	bool SkipValue();
+
+private:
+	void SkipWhitespace();
+	bool SkipString();
+	bool ReadLiteral(FStringView Literal);
+
+	const TCHAR* Cursor;
+	const TCHAR* End;
+};
+
+template<typename FunctionType>
+bool FButtplugJsonReader::ReadObject(FunctionType&& Func)
+{
+	if (!TryConsume(TEXT('{'))) return false;
+	if (TryConsume(TEXT('}'))) return true;
+	do
+	{
+		FStringView Key;
+		if (!ReadStringView(Key) || !TryConsume(TEXT(':'))) return false;
+		if (!Func(Key)) return false;
+	}
+	while (TryConsume(TEXT(',')));
+	return TryConsume(TEXT('}'));
+}
+
+template<typename FunctionType>
+bool FButtplugJsonReader::ReadArray(FunctionType&& Func)
+{
+	if (!TryConsume(TEXT('['))) return false;
+	if (TryConsume(TEXT(']'))) return true;
+	do
+	{
+		if (!Func()) return false;
+	}
+	while (TryConsume(TEXT(',')));
+	return TryConsume(TEXT(']'));
+}
+
+template<typename ElementType, typename AllocatorType>
+bool FButtplugJsonReader::ReadValue(TArray<ElementType, AllocatorType>& OutValue)
+{
+	OutValue.Reset();
+	return ReadArray([this, &OutValue]() { return ReadValue(OutValue.AddDefaulted_GetRef()); });
+}
@@ -0,0 +1,200 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugJsonWriter.h"
+
+#include "Containers/StringConv.h"
+
+void FButtplugJsonWriter::WriteSeparator()
+{
+	if (bNeedsComma)
+	{
+		Append(',');
+	}
+	bNeedsComma = true;
+}
+
+void FButtplugJsonWriter::WriteKey(FAnsiStringView Key)
+{
+	WriteSeparator();
+	Append('"');
+	Append(Key);
+	Append('"');
+	Append(':');
+	// The value following a key does not need a separator of its own.
+	bNeedsComma = false;
+}
+
+void FButtplugJsonWriter::WriteArrayStart()
+{
+	WriteSeparator();
+	Append('[');
+	bNeedsComma = false;
+}
+
+void FButtplugJsonWriter::WriteArrayEnd()
+{
+	Append(']');
+	bNeedsComma = true;
+}
+
+void FButtplugJsonWriter::WriteObjectStart()
+{
+	WriteSeparator();
+	Append('{');
+	bNeedsComma = false;
+}
+
+void FButtplugJsonWriter::WriteObjectEnd()
+{
+	Append('}');
+	bNeedsComma = true;
+}
+
+void FButtplugJsonWriter::WriteUnsigned(uint64 Value)
+{
+	ANSICHAR Digits[20];
+	int32 Count = 0;
+	do
+	{
+		Digits[Count++] = static_cast<ANSICHAR>('0' + Value % 10);
+		Value /= 10;
+	}
+	while (Value != 0);
+
+	while (Count > 0)
+	{
+		Append(Digits[--Count]);
+	}
+}
+
+void FButtplugJsonWriter::WriteValue(uint32 Value)
+{
+	WriteSeparator();
+	WriteUnsigned(Value);
+}
+
+void FButtplugJsonWriter::WriteValue(int32 Value)
+{
+	WriteValue(int64(Value));
+}
+
+void FButtplugJsonWriter::WriteValue(int64 Value)
+{
+	WriteSeparator();
+	if (Value < 0)
+	{
+		Append('-');
+		WriteUnsigned(uint64(0) - uint64(Value));
+	}
+	else
+	{
+		WriteUnsigned(uint64(Value));
+	}
+}
+
+void FButtplugJsonWriter::WriteValue(double Value)
+{
+	WriteSeparator();
+	if (!FMath::IsFinite(Value))
+	{
+		// JSON has no representation for these; they can only come from bad math upstream.
+		Append('0');
+		return;
+	}
+
+	// The fewest significant digits that read back as the same double, so that a server converting a step's value back
+	// to a step with ceil or floor lands on the step it came from. %.17g always reads back exactly.
+	ANSICHAR Formatted[32];
+	int32 Len = 0;
+	for (int32 Precision = 15; Precision <= 17; ++Precision)
+	{
+		Len = FCStringAnsi::Snprintf(Formatted, UE_ARRAY_COUNT(Formatted), "%.*g", Precision, Value);
+		if (Precision == 17 || FCStringAnsi::Atod(Formatted) == Value) break;
+	}
+	Append(FAnsiStringView(Formatted, FMath::Clamp(Len, 0, UE_ARRAY_COUNT(Formatted) - 1)));
+}
+
+void FButtplugJsonWriter::WriteValue(bool Value)
+{
+	WriteSeparator();
+	Append(Value ? ANSITEXTVIEW("true") : ANSITEXTVIEW("false"));
+}
+
+void FButtplugJsonWriter::WriteValue(FStringView Value)
+{
+	WriteSeparator();
+	Append('"');
+	for (int32 Index = 0; Index < Value.Len(); ++Index)
+	{
+		uint32 CodePoint = static_cast<uint32>(Value[Index]);
+
+		// Combine UTF-16 surrogate pairs; lone surrogates are replaced.
+		if (StringConv::IsHighSurrogate(CodePoint))
+		{
+			if (Index + 1 < Value.Len() && StringConv::IsLowSurrogate(static_cast<uint32>(Value[Index + 1])))
+			{
+				CodePoint = StringConv::EncodeSurrogate(static_cast<uint16>(CodePoint), static_cast<uint16>(Value[++Index]));
+			}
+			else
+			{
+				CodePoint = UNICODE_BOGUS_CHAR_CODEPOINT;
+			}
+		}
+		else if (StringConv::IsLowSurrogate(CodePoint))
+		{
+			CodePoint = UNICODE_BOGUS_CHAR_CODEPOINT;
+		}
+
+		switch (CodePoint)
+		{
+			case '"':  Append(ANSITEXTVIEW("\\\"")); continue;
+			case '\\': Append(ANSITEXTVIEW("\\\\")); continue;
+			case '\b': Append(ANSITEXTVIEW("\\b"));  continue;
+			case '\f': Append(ANSITEXTVIEW("\\f"));  continue;
+			case '\n': Append(ANSITEXTVIEW("\\n"));  continue;
+			case '\r': Append(ANSITEXTVIEW("\\r"));  continue;
+			case '\t': Append(ANSITEXTVIEW("\\t"));  continue;
+			default: break;
+		}
+
+		if (CodePoint < 0x20)
+		{
+			static const ANSICHAR HexDigits[] = "0123456789abcdef";
+			Append(ANSITEXTVIEW("\\u00"));
+			Append(HexDigits[CodePoint >> 4]);
+			Append(HexDigits[CodePoint & 0xF]);
+		}
+		else if (CodePoint < 0x80)
+		{
+			Append(static_cast<ANSICHAR>(CodePoint));
+		}
+		else if (CodePoint < 0x800)
+		{
+			Append(static_cast<ANSICHAR>(0xC0 | (CodePoint >> 6)));
+			Append(static_cast<ANSICHAR>(0x80 | (CodePoint & 0x3F)));
+		}
+		else if (CodePoint < 0x10000)
+		{
+			Append(static_cast<ANSICHAR>(0xE0 | (CodePoint >> 12)));
+			Append(static_cast<ANSICHAR>(0x80 | ((CodePoint >> 6) & 0x3F)));
+			Append(static_cast<ANSICHAR>(0x80 | (CodePoint & 0x3F)));
+		}
+		else
+		{
+			Append(static_cast<ANSICHAR>(0xF0 | (CodePoint >> 18)));
+			Append(static_cast<ANSICHAR>(0x80 | ((CodePoint >> 12) & 0x3F)));
+			Append(static_cast<ANSICHAR>(0x80 | ((CodePoint >> 6) & 0x3F)));
+			Append(static_cast<ANSICHAR>(0x80 | (CodePoint & 0x3F)));
+		}
+	}
+	Append('"');
+}
+
+void FButtplugJsonWriter::WriteValue(FAnsiStringView Value)
+{
+	// Only used for identifiers known to be plain ASCII; no escaping necessary.
+	WriteSeparator();
+	Append('"');
+	Append(Value);
+	Append('"');
+}
@@ -0,0 +1,45 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+/// Compact JSON writer emitting UTF-8 directly into a caller-owned byte buffer.
+/// Unlike TJsonWriter, this never builds an intermediate TCHAR string, so the buffer can be
+/// reused between sends and handed straight to the websocket without transcoding.
+class FButtplugJsonWriter
+{
+public:
+	/// Appends to the buffer; the caller is responsible for resetting it between documents.
+	explicit FButtplugJsonWriter(TArray<ANSICHAR>& InBuffer)
+		: Buffer(InBuffer)
+	{
+	}
+
+	void WriteArrayStart();
+	void WriteArrayEnd();
+	void WriteObjectStart();
+	void WriteObjectEnd();
+
+	void WriteValue(uint32 Value);
+	void WriteValue(int32 Value);
+	void WriteValue(int64 Value);
+	void WriteValue(double Value);
+	void WriteValue(bool Value);
+	void WriteValue(FStringView Value);
+	void WriteValue(FAnsiStringView Value);
+	void WriteValue(const FString& Value) { WriteValue(FStringView(Value)); }
+
+	/// Begin an object member; must be followed by exactly one value.
+	void WriteKey(FAnsiStringView Key);
+
+private:
+	void WriteSeparator();
+	void WriteUnsigned(uint64 Value);
+	void Append(ANSICHAR Char) { Buffer.Add(Char); }
+	void Append(FAnsiStringView Chars) { Buffer.Append(Chars.GetData(), Chars.Len()); }
+
+	TArray<ANSICHAR>& Buffer;
+	bool bNeedsComma = false;
+};
@@ -3,91 +3,264 @@
 #include "ButtplugMessage.h"
 
 #include "ButtplugConversions.h"
+#include "ButtplugJsonReader.h"
+#include "ButtplugJsonWriter.h"
+#include "Logging/StructuredLog.h"
 
-TUniquePtr<FButtplugMessage> FButtplugMessage::Make(EButtplugMessageType InMessageType)
+namespace
 {
-	switch (InMessageType)
+
+template<typename MessageType, typename = void>
+constexpr bool THasDeviceIndex = false;
+
+template<typename MessageType>
+constexpr bool THasDeviceIndex<MessageType, std::void_t<decltype(MessageType::DeviceIndex)>> = true;
+
+template<int32... Indices>
+void EmplaceDefaultMessage(FButtplugMessageVariant& Variant, EButtplugMessageType MessageType, TIntegerSequence<int32, Indices...>)
+{
+	using FEmplaceFunction = void (*)(FButtplugMessageVariant&);
+	static constexpr FEmplaceFunction EmplaceFunctions[] =
+	{
+		[](FButtplugMessageVariant& Target)
+		{
+			Target.Emplace<TButtplugMessage<Buttplug::Private::TEnumNameTraits<EButtplugMessageType>::Values[Indices]>>();
+		}...
+	};
+
+	int32 Index = static_cast<int32>(MessageType);
+	check(Index >= 0 && Index < static_cast<int32>(UE_ARRAY_COUNT(EmplaceFunctions)));
+	EmplaceFunctions[Index](Variant);
+}
+
+} // namespace
+
+void FButtplugMessageVariant::EmplaceDefault(EButtplugMessageType MessageType)
+{
+	EmplaceDefaultMessage(*this, MessageType, TMakeIntegerSequence<int32, Buttplug::Private::TEnumNameTable<EButtplugMessageType>::Num>());
+}
+
+TOptional<uint32> FButtplugMessageVariant::GetDeviceIndex() const
+{
+	return Visit([](const auto& Message) -> TOptional<uint32>
+	{
+		if constexpr (THasDeviceIndex<std::decay_t<decltype(Message)>>)
+		{
+			return Message.DeviceIndex;
+		}
+		else
+		{
+			return {};
+		}
+	});
+}
+
+namespace
+{
+
+using Buttplug::Private::THasMessageFields;
+
+template<typename StructType>
+void WriteObject(FButtplugJsonWriter& Writer, const StructType& Value);
+template<typename ValueType>
+void WriteFieldValue(FButtplugJsonWriter& Writer, const ValueType& Value);
+template<typename ElementType, typename AllocatorType>
+void WriteFieldValue(FButtplugJsonWriter& Writer, const TArray<ElementType, AllocatorType>& Values);
+void WriteFieldValue(FButtplugJsonWriter& Writer, const FInt32Interval& Value);
+
+template<typename ValueType>
+void WriteFieldValue(FButtplugJsonWriter& Writer, const ValueType& Value)
+{
+	if constexpr (THasMessageFields<ValueType>)
+	{
+		WriteObject(Writer, Value);
+	}
+	else if constexpr (TIsEnum<ValueType>::Value)
+	{
+		if constexpr (Buttplug::Private::TEnumNameTraits<ValueType>::bDefined)
+		{
+			Writer.WriteValue(Buttplug::Private::GetEnumName(Value));
+		}
+		else
+		{
+			Writer.WriteValue(static_cast<int64>(Value));
+		}
+	}
+	else
+	{
+		Writer.WriteValue(Value);
+	}
+}
+
+template<typename ElementType, typename AllocatorType>
+void WriteFieldValue(FButtplugJsonWriter& Writer, const TArray<ElementType, AllocatorType>& Values)
+{
+	Writer.WriteArrayStart();
+	for (const ElementType& Value : Values)
 	{
-		case EButtplugMessageType::Ok:                   return MakeUnique<FButtplugMessage::Ok>();
-		case EButtplugMessageType::Error:                return MakeUnique<FButtplugMessage::Error>();
-		case EButtplugMessageType::Ping:                 return MakeUnique<FButtplugMessage::Ping>();
-		case EButtplugMessageType::RequestServerInfo:    return MakeUnique<FButtplugMessage::RequestServerInfo>();
-		case EButtplugMessageType::ServerInfo:           return MakeUnique<FButtplugMessage::ServerInfo>();
-		case EButtplugMessageType::StartScanning:        return MakeUnique<FButtplugMessage::StartScanning>();
-		case EButtplugMessageType::StopScanning:         return MakeUnique<FButtplugMessage::StopScanning>();
-		case EButtplugMessageType::ScanningFinished:     return MakeUnique<FButtplugMessage::ScanningFinished>();
-		case EButtplugMessageType::RequestDeviceList:    return MakeUnique<FButtplugMessage::RequestDeviceList>();
-		case EButtplugMessageType::DeviceList:           return MakeUnique<FButtplugMessage::DeviceList>();
-		case EButtplugMessageType::DeviceAdded:          return MakeUnique<FButtplugMessage::DeviceAdded>();
-		case EButtplugMessageType::DeviceRemoved:        return MakeUnique<FButtplugMessage::DeviceRemoved>();
-		case EButtplugMessageType::StopDeviceCmd:        return MakeUnique<FButtplugMessage::StopDeviceCmd>();
-		case EButtplugMessageType::StopAllDevices:       return MakeUnique<FButtplugMessage::StopAllDevices>();
-		case EButtplugMessageType::ScalarCmd:            return MakeUnique<FButtplugMessage::ScalarCmd>();
-		case EButtplugMessageType::LinearCmd:            return MakeUnique<FButtplugMessage::LinearCmd>();
-		case EButtplugMessageType::RotateCmd:            return MakeUnique<FButtplugMessage::RotateCmd>();
-		case EButtplugMessageType::SensorReadCmd:        return MakeUnique<FButtplugMessage::SensorReadCmd>();
-		case EButtplugMessageType::SensorReading:        return MakeUnique<FButtplugMessage::SensorReading>();
-		case EButtplugMessageType::SensorSubscribeCmd:   return MakeUnique<FButtplugMessage::SensorSubscribeCmd>();
-		case EButtplugMessageType::SensorUnsubscribeCmd: return MakeUnique<FButtplugMessage::SensorUnsubscribeCmd>();
-		default:                   checkNoEntry();       return nullptr;
+		WriteFieldValue(Writer, Value);
 	}
+	Writer.WriteArrayEnd();
 }
 
-FString WriteButtplugMessagesToJson(const FButtplugMessageArray& Messages)
+void WriteFieldValue(FButtplugJsonWriter& Writer, const FInt32Interval& Value)
 {
-	FString OutJson;
-	WriteButtplugMessagesToJson(Messages, OutJson);
-	return OutJson;
+	Writer.WriteArrayStart();
+	Writer.WriteValue(Value.Min);
+	Writer.WriteValue(Value.Max);
+	Writer.WriteArrayEnd();
 }
 
-void WriteButtplugMessagesToJson(const FButtplugMessageArray& Messages, FString& OutJson)
+template<typename StructType>
+void WriteObject(FButtplugJsonWriter& Writer, const StructType& Value)
 {
-	TSharedRef<TJsonWriter<>> JsonWriter = TJsonWriterFactory<>::Create(&OutJson);
-	JsonWriter->WriteArrayStart();
-	for (const TUniquePtr<FButtplugMessage>& Message : Messages)
+	static_assert(Buttplug::Private::DoFieldKeysFindTheirFields<StructType>(), "Each key a message writes must be found as the field it was written from");
+	Writer.WriteObjectStart();
+	StructType::VisitFields([&](const auto&... Fields)
 	{
-		FString MessageTypeName = Buttplug::Private::GetEnumAsString(Message->GetMessageType());
-		JsonWriter->WriteObjectStart();
-		JsonWriter->WriteObjectStart(MessageTypeName);
-		Message->ToJson(JsonWriter, /*bFlatObject:*/true);
-		JsonWriter->WriteObjectEnd();
-		JsonWriter->WriteObjectEnd();
+		((Writer.WriteKey(Fields.Name), WriteFieldValue(Writer, Fields.Get(Value))), ...);
+	});
+	Writer.WriteObjectEnd();
+}
+
+} // namespace
+
+void WriteButtplugMessagesToJson(const FButtplugMessageArray& Messages, TArray<ANSICHAR>& OutUtf8)
+{
+	OutUtf8.Reset();
+	FButtplugJsonWriter Writer(OutUtf8);
+	Writer.WriteArrayStart();
+	for (const FButtplugMessageVariant& Message : Messages)
+	{
+		Writer.WriteObjectStart();
+		Writer.WriteKey(Buttplug::Private::GetEnumName(Message.GetMessageType()));
+		Message.Visit([&Writer](const auto& TypedMessage) { WriteObject(Writer, TypedMessage); });
+		Writer.WriteObjectEnd();
 	}
-	JsonWriter->WriteArrayEnd();
-	verify(JsonWriter->Close());
+	Writer.WriteArrayEnd();
 }
 
+namespace
+{
+
+template<typename StructType>
+bool ReadObject(FButtplugJsonReader& Reader, StructType& OutValue);
+template<typename ValueType>
+bool ReadFieldValue(FButtplugJsonReader& Reader, ValueType& OutValue);
+template<typename ElementType, typename AllocatorType>
+bool ReadFieldValue(FButtplugJsonReader& Reader, TArray<ElementType, AllocatorType>& OutValues);
+bool ReadFieldValue(FButtplugJsonReader& Reader, FInt32Interval& OutValue);
 
-bool ReadButtplugMessagesFromJson(const FString& Json, FButtplugMessageArray& OutMessages)
+template<typename ValueType>
+bool ReadFieldValue(FButtplugJsonReader& Reader, ValueType& OutValue)
 {
-	TSharedRef<TJsonReader<>> JsonReader = TJsonReaderFactory<>::Create(Json);
-	TArray<TSharedPtr<FJsonValue>> JsonValueArray;
-	if (!FJsonSerializer::Deserialize(JsonReader, JsonValueArray))
+	if constexpr (THasMessageFields<ValueType>)
 	{
-		return false;
+		return ReadObject(Reader, OutValue);
 	}
-	
-	OutMessages.Empty();
-	bool bSuccess = true;
-	for (const TSharedPtr<FJsonValue>& JsonValue : JsonValueArray)
+	else if constexpr (TIsEnum<ValueType>::Value)
 	{
-		const TSharedPtr<FJsonObject>& JsonObject = JsonValue->AsObject();
-		bSuccess &= JsonObject->Values.Num() != 0;
-		for (auto const& Field : JsonObject->Values)
+		if constexpr (Buttplug::Private::TEnumNameTraits<ValueType>::bDefined)
 		{
+			FStringView Name;
+			return Reader.ReadStringView(Name) && Buttplug::Private::FindEnumByName(Name, OutValue);
+		}
+		else
+		{
+			int64 Value = 0;
+			if (!Reader.ReadValue(Value)) return false;
+			OutValue = static_cast<ValueType>(Value);
+			return true;
+		}
+	}
+	else
+	{
+		return Reader.ReadValue(OutValue);
+	}
+}
+
+template<typename ElementType, typename AllocatorType>
+bool ReadFieldValue(FButtplugJsonReader& Reader, TArray<ElementType, AllocatorType>& OutValues)
+{
+	OutValues.Reset();
+	return Reader.ReadArray([&]() { return ReadFieldValue(Reader, OutValues.AddDefaulted_GetRef()); });
+}
+
+bool ReadFieldValue(FButtplugJsonReader& Reader, FInt32Interval& OutValue)
+{
+	int32 Count = 0;
+	bool bSuccess = Reader.ReadArray([&]()
+	{
+		switch (Count++)
+		{
+		case 0: return Reader.ReadValue(OutValue.Min);
+		case 1: return Reader.ReadValue(OutValue.Max);
+		default: return false;
+		}
+	});
+	return bSuccess && Count == 2;
+}
+
+template<typename StructType>
+bool ReadObject(FButtplugJsonReader& Reader, StructType& OutValue)
+{
+	constexpr uint64 RequiredFields = Buttplug::Private::GetRequiredFieldMask<StructType>();
+	uint64 SeenFields = 0;
+	bool bSuccess = Reader.ReadObject([&](FStringView Key)
+	{
+		int32 FieldIndex = Buttplug::Private::FindFieldIndex<StructType>(Key);
+		if (FieldIndex == INDEX_NONE) return Reader.SkipValue();
+		SeenFields |= uint64(1) << FieldIndex;
+		return StructType::VisitFields([&](const auto&... Fields)
+		{
+			int32 Index = 0;
+			bool bReadField = false;
+			((Index++ == FieldIndex ? (bReadField = ReadFieldValue(Reader, Fields.Get(OutValue)), true) : false) || ...);
+			return bReadField;
+		});
+	});
+	return bSuccess && (SeenFields & RequiredFields) == RequiredFields;
+}
+
+} // namespace
+
+bool ReadButtplugMessagesFromJson(const FString& Json, FButtplugMessageArray& OutMessages)
+{
+	OutMessages.Reset();
+	FButtplugJsonReader Reader(Json);
+	bool bSuccess = Reader.ReadArray([&]()
+	{
+		return Reader.ReadObject([&](FStringView Key)
+		{
+			// Messages that can't be decoded are skipped one at a time, so that the rest of the frame still arrives.
 			EButtplugMessageType MessageType;
-			if (Buttplug::Private::GetEnumByName(Field.Key, MessageType))
+			if (!Buttplug::Private::FindEnumByName(Key, MessageType))
 			{
-				TUniquePtr<FButtplugMessage>& Message = OutMessages.Add_GetRef(FButtplugMessage::Make(MessageType));
-				bSuccess &= Message->FromJson(Field.Value->AsObject());
+				UE_LOGFMT(LogButtplug, Warning, "Skipping Buttplug message of unknown type {Type}", FString(Key));
+				return Reader.SkipValue();
 			}
-			else
+
+			const TCHAR* MessageStart = Reader.GetPosition();
+			FButtplugMessageVariant& Message = OutMessages.AddDefaulted_GetRef();
+			Message.EmplaceDefault(MessageType);
+			if (!Message.Visit([&Reader](auto& TypedMessage) { return ReadObject(Reader, TypedMessage); }))
 			{
-				bSuccess = false;
-				continue;
+				// Don't hand a partially decoded message to the subsystem.
+				OutMessages.Pop(false);
+				UE_LOGFMT(LogButtplug, Warning, "Skipping Buttplug {Type} message that failed to decode", FString(Key));
+				Reader.Rewind(MessageStart);
+				return Reader.SkipValue();
 			}
-		}
-	}
+			return true;
+		});
+	});
+	bSuccess &= Reader.IsAtEnd();
 
+	if (!bSuccess)
+	{
+		// Not valid JSON, so nothing in it can be trusted.
+		OutMessages.Reset();
+		UE_LOGFMT(LogButtplug, Warning, "Failed to decode Buttplug message {Json}", Json);
+	}
 	return bSuccess;
 }
@@ -5,7 +5,10 @@
 #include "CoreMinimal.h"
 #include "ButtplugMinimal.h"
 
-#include "Serialization/JsonSerializerMacros.h"
+#include "ButtplugConversions.h"
+#include "ButtplugFeature.h"
+#include "ButtplugMessageFields.h"
+#include "Misc/TVariant.h"
 
 #include "ButtplugMessage.generated.h"
 
@@ -37,21 +40,17 @@ enum class EButtplugMessageType : uint8
 	SensorUnsubscribeCmd,
 };
 
+BUTTPLUG_DEFINE_ENUM_NAMES(EButtplugMessageType, FOREACH_ENUM_EBUTTPLUGMESSAGETYPE, 24)
+BUTTPLUG_DEFINE_ENUM_NAMES(EButtplugFeatureType, FOREACH_ENUM_EBUTTPLUGFEATURETYPE, 9)
+
 /// A message passed between the Buttplug client and server.
-struct FButtplugMessage : FJsonSerializable
+/// Messages are stored by value in a FButtplugMessageVariant rather than behind a base pointer.
+struct FButtplugMessage
 {
 	uint32 Id = 0;
 
-	virtual EButtplugMessageType GetMessageType() const = 0;
 	FORCEINLINE static constexpr uint32 SpecVersion() { return 3; }
 
-	static TUniquePtr<FButtplugMessage> Make(EButtplugMessageType MessageType);
-
-	template<typename FunctionType>
-	auto Dispatch(const FunctionType& Func);
-	template<typename FunctionType>
-	auto Dispatch(const FunctionType& Func) const;
-
 	using Ok = TButtplugMessage<EButtplugMessageType::Ok>;
 	using Error = TButtplugMessage<EButtplugMessageType::Error>;
 	using Ping = TButtplugMessage<EButtplugMessageType::Ping>;
@@ -87,137 +86,18 @@ template<EButtplugMessageType MessageType>
 struct TButtplugMessage : FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return MessageType; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 	static_assert(sizeof(TButtplugMessage) < 0, "Missing specialization for TButtplugMessage");
 };
 
-template<typename FunctionType>
-auto FButtplugMessage::Dispatch(const FunctionType& Func)
-{
-	switch (GetMessageType())
-	{
-		case EButtplugMessageType::Ok:                   return Func(*Cast<FButtplugMessage::Ok>(this));
-		case EButtplugMessageType::Error:                return Func(*Cast<FButtplugMessage::Error>(this));
-		case EButtplugMessageType::Ping:                 return Func(*Cast<FButtplugMessage::Ping>(this));
-		case EButtplugMessageType::RequestServerInfo:    return Func(*Cast<FButtplugMessage::RequestServerInfo>(this));
-		case EButtplugMessageType::ServerInfo:           return Func(*Cast<FButtplugMessage::ServerInfo>(this));
-		case EButtplugMessageType::StartScanning:        return Func(*Cast<FButtplugMessage::StartScanning>(this));
-		case EButtplugMessageType::StopScanning:         return Func(*Cast<FButtplugMessage::StopScanning>(this));
-		case EButtplugMessageType::ScanningFinished:     return Func(*Cast<FButtplugMessage::ScanningFinished>(this));
-		case EButtplugMessageType::RequestDeviceList:    return Func(*Cast<FButtplugMessage::RequestDeviceList>(this));
-		case EButtplugMessageType::DeviceList:           return Func(*Cast<FButtplugMessage::DeviceList>(this));
-		case EButtplugMessageType::DeviceAdded:          return Func(*Cast<FButtplugMessage::DeviceAdded>(this));
-		case EButtplugMessageType::DeviceRemoved:        return Func(*Cast<FButtplugMessage::DeviceRemoved>(this));
-		case EButtplugMessageType::StopDeviceCmd:        return Func(*Cast<FButtplugMessage::StopDeviceCmd>(this));
-		case EButtplugMessageType::StopAllDevices:       return Func(*Cast<FButtplugMessage::StopAllDevices>(this));
-		case EButtplugMessageType::ScalarCmd:            return Func(*Cast<FButtplugMessage::ScalarCmd>(this));
-		case EButtplugMessageType::LinearCmd:            return Func(*Cast<FButtplugMessage::LinearCmd>(this));
-		case EButtplugMessageType::RotateCmd:            return Func(*Cast<FButtplugMessage::RotateCmd>(this));
-		case EButtplugMessageType::SensorReadCmd:        return Func(*Cast<FButtplugMessage::SensorReadCmd>(this));
-		case EButtplugMessageType::SensorReading:        return Func(*Cast<FButtplugMessage::SensorReading>(this));
-		case EButtplugMessageType::SensorSubscribeCmd:   return Func(*Cast<FButtplugMessage::SensorSubscribeCmd>(this));
-		case EButtplugMessageType::SensorUnsubscribeCmd: return Func(*Cast<FButtplugMessage::SensorUnsubscribeCmd>(this));
-		default:                   checkNoEntry();
-	}
-}
-
-template<typename FunctionType>
-auto FButtplugMessage::Dispatch(const FunctionType& Func) const
-{
-	switch (GetMessageType())
-	{
-		case EButtplugMessageType::Ok:                   return Func(*Cast<FButtplugMessage::Ok>(this));
-		case EButtplugMessageType::Error:                return Func(*Cast<FButtplugMessage::Error>(this));
-		case EButtplugMessageType::Ping:                 return Func(*Cast<FButtplugMessage::Ping>(this));
-		case EButtplugMessageType::RequestServerInfo:    return Func(*Cast<FButtplugMessage::RequestServerInfo>(this));
-		case EButtplugMessageType::ServerInfo:           return Func(*Cast<FButtplugMessage::ServerInfo>(this));
-		case EButtplugMessageType::StartScanning:        return Func(*Cast<FButtplugMessage::StartScanning>(this));
-		case EButtplugMessageType::StopScanning:         return Func(*Cast<FButtplugMessage::StopScanning>(this));
-		case EButtplugMessageType::ScanningFinished:     return Func(*Cast<FButtplugMessage::ScanningFinished>(this));
-		case EButtplugMessageType::RequestDeviceList:    return Func(*Cast<FButtplugMessage::RequestDeviceList>(this));
-		case EButtplugMessageType::DeviceList:           return Func(*Cast<FButtplugMessage::DeviceList>(this));
-		case EButtplugMessageType::DeviceAdded:          return Func(*Cast<FButtplugMessage::DeviceAdded>(this));
-		case EButtplugMessageType::DeviceRemoved:        return Func(*Cast<FButtplugMessage::DeviceRemoved>(this));
-		case EButtplugMessageType::StopDeviceCmd:        return Func(*Cast<FButtplugMessage::StopDeviceCmd>(this));
-		case EButtplugMessageType::StopAllDevices:       return Func(*Cast<FButtplugMessage::StopAllDevices>(this));
-		case EButtplugMessageType::ScalarCmd:            return Func(*Cast<FButtplugMessage::ScalarCmd>(this));
-		case EButtplugMessageType::LinearCmd:            return Func(*Cast<FButtplugMessage::LinearCmd>(this));
-		case EButtplugMessageType::RotateCmd:            return Func(*Cast<FButtplugMessage::RotateCmd>(this));
-		case EButtplugMessageType::SensorReadCmd:        return Func(*Cast<FButtplugMessage::SensorReadCmd>(this));
-		case EButtplugMessageType::SensorReading:        return Func(*Cast<FButtplugMessage::SensorReading>(this));
-		case EButtplugMessageType::SensorSubscribeCmd:   return Func(*Cast<FButtplugMessage::SensorSubscribeCmd>(this));
-		case EButtplugMessageType::SensorUnsubscribeCmd: return Func(*Cast<FButtplugMessage::SensorUnsubscribeCmd>(this));
-		default:                   checkNoEntry();
-	}
-}
-
-using FButtplugMessageArray = TArray<TUniquePtr<FButtplugMessage>>;
-
-FString WriteButtplugMessagesToJson(const FButtplugMessageArray& Messages);
-void WriteButtplugMessagesToJson(const FButtplugMessageArray& Messages, FString& OutJson);
-bool ReadButtplugMessagesFromJson(const FString& Json, FButtplugMessageArray& OutMessages);
-
-template<typename InMessageType UE_REQUIRES(TIsDerivedFrom<InMessageType, FButtplugMessage>::Value)>
-FORCEINLINE InMessageType* Cast(FButtplugMessage* Src)
-{
-	return Src && (Src->GetMessageType() == InMessageType::StaticMessageType())
-		? (InMessageType*)Src : nullptr;
-}
-
-template<typename InMessageType>
-FORCEINLINE InMessageType* ExactCast(FButtplugMessage* Src)
-{
-	return Cast<InMessageType>(Src);
-}
-
-UE_PUSH_MACRO("JSON_SERIALIZE_ENUM_AS_INT");
-#define JSON_SERIALIZE_ENUM_AS_INT(JsonName, JsonEnum) \
-		if (Serializer.IsLoading()) \
-		{ \
-			int64 JsonInt = 0; \
-			Serializer.Serialize(TEXT(JsonName), JsonInt); \
-			JsonEnum = static_cast<decltype(JsonEnum)>(JsonInt); \
-		} \
-		else \
-		{ \
-			int64 JsonInt = static_cast<int64>(JsonEnum); \
-			Serializer.Serialize(TEXT(JsonName), JsonInt); \
-		}
-
-UE_PUSH_MACRO("JSON_SERIALIZE_SERIALIZABLE_FLATTEN");
-#define JSON_SERIALIZE_SERIALIZABLE_FLATTEN(JsonName, JsonObject) \
-		JsonObject.Serialize(Serializer, true);
-
-UE_PUSH_MACRO("JSON_SERIALIZE_CUSTOM");
-#define JSON_SERIALIZE_CUSTOM(JsonName, LoadCustomJson, SaveCustomJson) \
-		if (Serializer.IsLoading()) \
-		{ \
-			if (Serializer.GetObject()->HasField(TEXT(JsonName))) \
-			{ \
-				TSharedPtr<FJsonValue> JsonValue = Serializer.GetObject()->GetField<EJson::None>(TEXT(JsonName)); \
-				this->LoadCustomJson(JsonValue); \
-			} \
-			else \
-			{ \
-				this->LoadCustomJson(TSharedPtr<FJsonValue>(nullptr)); \
-			} \
-		} \
-		else \
-		{ \
-			AsConst(*this).SaveCustomJson(Serializer); \
-		}
-
 // Status messages
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::Ok> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::Ok; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
 enum class FButtplugMessage::ErrorCode : uint8
@@ -236,24 +116,20 @@ struct TButtplugMessage<EButtplugMessageType::Error> : public FButtplugMessage
 	ErrorCode Code = {};
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::Error; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("ErrorMessage", Message);
-	JSON_SERIALIZE_ENUM_AS_INT("ErrorCode", Code);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("ErrorMessage", &TButtplugMessage::Message),
+		Field("ErrorCode", &TButtplugMessage::Code));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::Ping> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::Ping; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
 // Handshake messages
@@ -265,13 +141,11 @@ struct TButtplugMessage<EButtplugMessageType::RequestServerInfo> : public FButtp
 	uint32 MessageVersion = 0;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::RequestServerInfo; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("ClientName", ClientName);
-	JSON_SERIALIZE("MessageVersion", MessageVersion);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("ClientName", &TButtplugMessage::ClientName),
+		Field("MessageVersion", &TButtplugMessage::MessageVersion));
 };
 
 template<>
@@ -282,14 +156,12 @@ struct TButtplugMessage<EButtplugMessageType::ServerInfo> : public FButtplugMess
 	uint32 MaxPingTime = 0;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::ServerInfo; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE_WITHDEFAULT("ServerName", ServerName, TEXT(""));
-	JSON_SERIALIZE("MessageVersion", MessageVersion);
-	JSON_SERIALIZE("MaxPingTime", MaxPingTime);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		OptionalField("ServerName", &TButtplugMessage::ServerName),
+		Field("MessageVersion", &TButtplugMessage::MessageVersion),
+		Field("MaxPingTime", &TButtplugMessage::MaxPingTime));
 };
 
 // Enumeration messages
@@ -298,47 +170,39 @@ template<>
 struct TButtplugMessage<EButtplugMessageType::StartScanning> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::StartScanning; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::StopScanning> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::StopScanning; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::ScanningFinished> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::ScanningFinished; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::RequestDeviceList> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::RequestDeviceList; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
-struct FButtplugMessage::DeviceMessageAttributes : public FJsonSerializable
+struct FButtplugMessage::DeviceMessageAttributes
 {
 	FString FeatureDescriptor;
 	uint32 StepCount = 0;
@@ -346,44 +210,15 @@ struct FButtplugMessage::DeviceMessageAttributes : public FJsonSerializable
 	FString SensorType;
 	TArray<FInt32Interval> SensorRange;
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE_WITHDEFAULT("FeatureDescriptor", FeatureDescriptor, TEXT(""));
-	JSON_SERIALIZE_WITHDEFAULT("StepCount", StepCount, 0);
-	JSON_SERIALIZE_WITHDEFAULT("ActuatorType", ActuatorType, TEXT(""));
-	JSON_SERIALIZE_WITHDEFAULT("SensorType", SensorType, TEXT(""));
-	JSON_SERIALIZE_CUSTOM("SensorRange", LoadSensorRangeFromJson, SaveSensorRangeToJson);
-	END_JSON_SERIALIZER;
-
-private:
-	void LoadSensorRangeFromJson(const TSharedPtr<FJsonValue>& JsonValue)
-	{
-		if (!JsonValue.IsValid())
-		{
-			SensorRange.Empty();
-			return;
-		}
-
-		const TArray<TSharedPtr<FJsonValue>>& JsonRanges = JsonValue->AsArray();
-		SensorRange.Empty(JsonRanges.Num());
-		for (const TSharedPtr<FJsonValue>& JsonRange : JsonRanges)
-		{
-			const TArray<TSharedPtr<FJsonValue>>& JsonArray = JsonRange->AsArray();
-			if (JsonArray.Num() == 2)
-			{
-				int32 LowerBound = FMath::RoundToInt32(JsonArray[0]->AsNumber());
-				int32 UpperBound = FMath::RoundToInt32(JsonArray[1]->AsNumber());
-				SensorRange.Add(FInt32Interval(LowerBound, UpperBound));
-			}
-		}
-	}
-
-	void SaveSensorRangeToJson(FJsonSerializerBase& Serializer) const
-	{
-		unimplemented();
-	}
+	BUTTPLUG_MESSAGE_FIELDS(
+		OptionalField("FeatureDescriptor", &DeviceMessageAttributes::FeatureDescriptor),
+		OptionalField("StepCount", &DeviceMessageAttributes::StepCount),
+		OptionalField("ActuatorType", &DeviceMessageAttributes::ActuatorType),
+		OptionalField("SensorType", &DeviceMessageAttributes::SensorType),
+		OptionalField("SensorRange", &DeviceMessageAttributes::SensorRange));
 };
 
-struct FButtplugMessage::DeviceMessages : public FJsonSerializable
+struct FButtplugMessage::DeviceMessages
 {
 	TArray<DeviceMessageAttributes> ScalarCmd;
 	TArray<DeviceMessageAttributes> LinearCmd;
@@ -391,16 +226,15 @@ struct FButtplugMessage::DeviceMessages : public FJsonSerializable
 	TArray<DeviceMessageAttributes> SensorReadCmd;
 	TArray<DeviceMessageAttributes> SensorSubscribeCmd;
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE_WITHDEFAULT("ScalarCmd", ScalarCmd, DeviceMessageAttributes, {});
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE_WITHDEFAULT("LinearCmd", LinearCmd, DeviceMessageAttributes, {});
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE_WITHDEFAULT("RotateCmd", RotateCmd, DeviceMessageAttributes, {});
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE_WITHDEFAULT("SensorReadCmd", SensorReadCmd, DeviceMessageAttributes, {});
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE_WITHDEFAULT("SensorSubscribeCmd", SensorSubscribeCmd, DeviceMessageAttributes, {});
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		OptionalField("ScalarCmd", &DeviceMessages::ScalarCmd),
+		OptionalField("LinearCmd", &DeviceMessages::LinearCmd),
+		OptionalField("RotateCmd", &DeviceMessages::RotateCmd),
+		OptionalField("SensorReadCmd", &DeviceMessages::SensorReadCmd),
+		OptionalField("SensorSubscribeCmd", &DeviceMessages::SensorSubscribeCmd));
 };
 
-struct FButtplugMessage::Device : public FJsonSerializable
+struct FButtplugMessage::Device
 {
 	FString Name;
 	uint32 Index = 0;
@@ -408,13 +242,12 @@ struct FButtplugMessage::Device : public FJsonSerializable
 	FString DisplayName;
 	DeviceMessages Messages;
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("DeviceName", Name);
-	JSON_SERIALIZE("DeviceIndex", Index);
-	JSON_SERIALIZE_WITHDEFAULT("DeviceMessageTimingGap", MessageTimingGap, 0);
-	JSON_SERIALIZE_WITHDEFAULT("DeviceDisplayName", DisplayName, TEXT(""));
-	JSON_SERIALIZE_OBJECT_SERIALIZABLE("DeviceMessages", Messages);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("DeviceName", &Device::Name),
+		Field("DeviceIndex", &Device::Index),
+		OptionalField("DeviceMessageTimingGap", &Device::MessageTimingGap),
+		OptionalField("DeviceDisplayName", &Device::DisplayName),
+		Field("DeviceMessages", &Device::Messages));
 };
 
 template<>
@@ -423,12 +256,10 @@ struct TButtplugMessage<EButtplugMessageType::DeviceList> : public FButtplugMess
 	TArray<Device> Devices;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::DeviceList; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE("Devices", Devices, Device);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("Devices", &TButtplugMessage::Devices));
 };
 
 template<>
@@ -437,12 +268,18 @@ struct TButtplugMessage<EButtplugMessageType::DeviceAdded> : public FButtplugMes
 	Device Device;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::DeviceAdded; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE_SERIALIZABLE_FLATTEN("Device", Device);
-	END_JSON_SERIALIZER;
+	static constexpr bool bHasMessageFields = true;
+	template<typename FunctionType>
+	static constexpr decltype(auto) VisitFields(FunctionType&& Func)
+	{
+		// The device's fields are written inline, alongside the message Id.
+		return FButtplugMessage::Device::VisitFields([&Func](const auto&... DeviceFields)
+		{
+			using namespace Buttplug::Private;
+			return Func(Field("Id", &TButtplugMessage::Id), Flatten(&TButtplugMessage::Device, DeviceFields)...);
+		});
+	}
 };
 
 template<>
@@ -451,12 +288,10 @@ struct TButtplugMessage<EButtplugMessageType::DeviceRemoved> : public FButtplugM
 	uint32 DeviceIndex = 0;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::DeviceRemoved; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex));
 };
 
 // Device messages
@@ -467,109 +302,96 @@ struct TButtplugMessage<EButtplugMessageType::StopDeviceCmd> : public FButtplugM
 	uint32 DeviceIndex = 0;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::StopDeviceCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::StopAllDevices> : public FButtplugMessage
 {
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::StopAllDevices; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id));
 };
 
-struct FButtplugMessage::Scalar : public FJsonSerializable
+struct FButtplugMessage::Scalar
 {
 	uint32 Index = 0;
 	double Value = 0.0;
-	FString ActuatorType;
+	EButtplugFeatureType ActuatorType = EButtplugFeatureType::Unknown;
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Index", Index);
-	JSON_SERIALIZE("Scalar", Value);
-	JSON_SERIALIZE("ActuatorType", ActuatorType);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Index", &Scalar::Index),
+		Field("Scalar", &Scalar::Value),
+		Field("ActuatorType", &Scalar::ActuatorType));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::ScalarCmd> : public FButtplugMessage
 {
 	uint32 DeviceIndex = 0;
-	TArray<Scalar> Scalars;
+	TArray<Scalar, TInlineAllocator<4>> Scalars;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::ScalarCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE("Scalars", Scalars, Scalar);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("Scalars", &TButtplugMessage::Scalars));
 };
 
-struct FButtplugMessage::Vector : public FJsonSerializable
+struct FButtplugMessage::Vector
 {
 	uint32 Index = 0;
 	uint32 Duration = 0;
 	double Position = 0;
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Index", Index);
-	JSON_SERIALIZE("Duration", Duration);
-	JSON_SERIALIZE("Position", Position);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Index", &Vector::Index),
+		Field("Duration", &Vector::Duration),
+		Field("Position", &Vector::Position));
 };
 
 template<> struct TButtplugMessage<EButtplugMessageType::LinearCmd> : public FButtplugMessage
 {
 	uint32 DeviceIndex = 0;
-	TArray<Vector> Vectors;
+	TArray<Vector, TInlineAllocator<4>> Vectors;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::LinearCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE("Vectors", Vectors, Vector);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("Vectors", &TButtplugMessage::Vectors));
 };
 
-struct FButtplugMessage::Rotation : public FJsonSerializable
+struct FButtplugMessage::Rotation
 {
 	uint32 Index = 0;
 	double Speed = 0;
 	bool Clockwise = false;
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Index", Index);
-	JSON_SERIALIZE("Speed", Speed);
-	JSON_SERIALIZE("Clockwise", Clockwise);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Index", &Rotation::Index),
+		Field("Speed", &Rotation::Speed),
+		Field("Clockwise", &Rotation::Clockwise));
 };
 
 template<>
 struct TButtplugMessage<EButtplugMessageType::RotateCmd> : public FButtplugMessage
 {
 	uint32 DeviceIndex = 0;
-	TArray<Rotation> Rotations;
+	TArray<Rotation, TInlineAllocator<4>> Rotations;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::RotateCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE_ARRAY_SERIALIZABLE("Rotations", Rotations, Rotation);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("Rotations", &TButtplugMessage::Rotations));
 };
 
 // Sensor messages
@@ -579,17 +401,15 @@ struct TButtplugMessage<EButtplugMessageType::SensorReadCmd> : public FButtplugM
 {
 	uint32 DeviceIndex = 0;
 	uint32 SensorIndex = 0;
-	FString SensorType;
+	EButtplugFeatureType SensorType = EButtplugFeatureType::Unknown;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::SensorReadCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE("SensorIndex", SensorIndex);
-	JSON_SERIALIZE("SensorType", SensorType);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("SensorIndex", &TButtplugMessage::SensorIndex),
+		Field("SensorType", &TButtplugMessage::SensorType));
 };
 
 template<>
@@ -597,19 +417,17 @@ struct TButtplugMessage<EButtplugMessageType::SensorReading> : public FButtplugM
 {
 	uint32 DeviceIndex = 0;
 	uint32 SensorIndex = 0;
-	FString SensorType;
-	TArray<int32> Data;
+	EButtplugFeatureType SensorType = EButtplugFeatureType::Unknown;
+	TArray<int32, TInlineAllocator<4>> Data;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::SensorReading; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE("SensorIndex", SensorIndex);
-	JSON_SERIALIZE("SensorType", SensorType);
-	JSON_SERIALIZE_ARRAY("Data", Data);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("SensorIndex", &TButtplugMessage::SensorIndex),
+		Field("SensorType", &TButtplugMessage::SensorType),
+		Field("Data", &TButtplugMessage::Data));
 };
 
 template<>
@@ -617,17 +435,15 @@ struct TButtplugMessage<EButtplugMessageType::SensorSubscribeCmd> : public FButt
 {
 	uint32 DeviceIndex = 0;
 	uint32 SensorIndex = 0;
-	FString SensorType;
+	EButtplugFeatureType SensorType = EButtplugFeatureType::Unknown;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::SensorSubscribeCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE("SensorIndex", SensorIndex);
-	JSON_SERIALIZE("SensorType", SensorType);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("SensorIndex", &TButtplugMessage::SensorIndex),
+		Field("SensorType", &TButtplugMessage::SensorType));
 };
 
 template<>
@@ -635,21 +451,102 @@ struct TButtplugMessage<EButtplugMessageType::SensorUnsubscribeCmd> : public FBu
 {
 	uint32 DeviceIndex = 0;
 	uint32 SensorIndex = 0;
-	FString SensorType;
+	EButtplugFeatureType SensorType = EButtplugFeatureType::Unknown;
 
 	FORCEINLINE static constexpr EButtplugMessageType StaticMessageType() { return EButtplugMessageType::SensorUnsubscribeCmd; }
-	virtual EButtplugMessageType GetMessageType() const override { return StaticMessageType(); }
 
-	BEGIN_JSON_SERIALIZER;
-	JSON_SERIALIZE("Id", Id);
-	JSON_SERIALIZE("DeviceIndex", DeviceIndex);
-	JSON_SERIALIZE("SensorIndex", SensorIndex);
-	JSON_SERIALIZE("SensorType", SensorType);
-	END_JSON_SERIALIZER;
+	BUTTPLUG_MESSAGE_FIELDS(
+		Field("Id", &TButtplugMessage::Id),
+		Field("DeviceIndex", &TButtplugMessage::DeviceIndex),
+		Field("SensorIndex", &TButtplugMessage::SensorIndex),
+		Field("SensorType", &TButtplugMessage::SensorType));
 };
 
 // Raw messages (are not provided due to being dangerous)
 
-UE_POP_MACRO("JSON_SERIALIZE_ENUM_AS_INT");
-UE_POP_MACRO("JSON_SERIALIZE_SERIALIZABLE_FLATTEN");
-UE_POP_MACRO("JSON_SERIALIZE_CUSTOM");
+namespace Buttplug::Private
+{
+
+template<typename IndexSequence>
+struct TButtplugMessageVariantBase;
+
+template<int32... Indices>
+struct TButtplugMessageVariantBase<TIntegerSequence<int32, Indices...>>
+{
+	// Generated from the enum so that the alternative index is always the message type.
+	using Type = TVariant<TButtplugMessage<TEnumNameTraits<EButtplugMessageType>::Values[Indices]>...>;
+};
+
+} // namespace Buttplug::Private
+
+/// Any Buttplug message, stored inline. Arrays of these keep a batch of messages in one flat buffer.
+struct FButtplugMessageVariant : Buttplug::Private::TButtplugMessageVariantBase<TMakeIntegerSequence<int32, Buttplug::Private::TEnumNameTable<EButtplugMessageType>::Num>>::Type
+{
+	using Super = Buttplug::Private::TButtplugMessageVariantBase<TMakeIntegerSequence<int32, Buttplug::Private::TEnumNameTable<EButtplugMessageType>::Num>>::Type;
+	using Super::Super;
+
+	FButtplugMessageVariant() = default;
+
+	EButtplugMessageType GetMessageType() const
+	{
+		return static_cast<EButtplugMessageType>(GetIndex());
+	}
+
+	/// Is this a stop command? Stop commands are never dropped or held back.
+	bool IsStop() const
+	{
+		EButtplugMessageType MessageType = GetMessageType();
+		return MessageType == EButtplugMessageType::StopDeviceCmd || MessageType == EButtplugMessageType::StopAllDevices;
+	}
+
+	/// Is this actuation or a sensor read? Only these are dropped or held back while the server is congested.
+	/// Stop commands, pings, handshakes and subscriptions always go, as the server or our state would drift otherwise.
+	bool IsDroppable() const
+	{
+		EButtplugMessageType MessageType = GetMessageType();
+		return MessageType == EButtplugMessageType::ScalarCmd || MessageType == EButtplugMessageType::LinearCmd
+			|| MessageType == EButtplugMessageType::RotateCmd || MessageType == EButtplugMessageType::SensorReadCmd;
+	}
+
+	/// Replace the held message with a default constructed message of the given type.
+	void EmplaceDefault(EButtplugMessageType MessageType);
+
+	/// Call Func with the held message as its concrete TButtplugMessage type.
+	template<typename FunctionType>
+	decltype(auto) Visit(FunctionType&& Func)
+	{
+		return ::Visit(Forward<FunctionType>(Func), static_cast<Super&>(*this));
+	}
+
+	/// Call Func with the held message as its concrete TButtplugMessage type.
+	template<typename FunctionType>
+	decltype(auto) Visit(FunctionType&& Func) const
+	{
+		return ::Visit(Forward<FunctionType>(Func), static_cast<const Super&>(*this));
+	}
+
+	/// The fields common to all messages.
+	FButtplugMessage& GetMessage()
+	{
+		return Visit([](FButtplugMessage& Message) -> FButtplugMessage& { return Message; });
+	}
+
+	/// The fields common to all messages.
+	const FButtplugMessage& GetMessage() const
+	{
+		return Visit([](const FButtplugMessage& Message) -> const FButtplugMessage& { return Message; });
+	}
+
+	/// The device the held message is addressed to or from, if it has one.
+	TOptional<uint32> GetDeviceIndex() const;
+};
+
+using FButtplugMessageArray = TArray<FButtplugMessageVariant>;
+
+/// Write messages as UTF-8 JSON, replacing the contents of (but reusing the allocation of) OutUtf8.
+void WriteButtplugMessagesToJson(const FButtplugMessageArray& Messages, TArray<ANSICHAR>& OutUtf8);
+/// Read messages from JSON, replacing the contents of (but reusing the allocation of) OutMessages.
+/// Messages of unknown type or that fail to decode are skipped individually. If the frame isn't valid JSON,
+/// OutMessages is left empty and this returns false.
+bool ReadButtplugMessagesFromJson(const FString& Json, FButtplugMessageArray& OutMessages);
+
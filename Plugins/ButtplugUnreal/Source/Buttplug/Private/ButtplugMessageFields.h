@@ -0,0 +1,186 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "ButtplugConversions.h"
+
+#include <type_traits>
+
+namespace Buttplug::Private
+{
+
+/// Describes one JSON member of a message struct: its key and where it lives in the struct.
+template<typename OwnerType, typename ValueType>
+struct TMessageField
+{
+	FAnsiStringView Name;
+	ValueType OwnerType::* Member;
+	/// Optional fields keep their default value when missing; missing required fields fail the read.
+	bool bOptional;
+
+	template<typename StructType>
+	constexpr auto& Get(StructType& Struct) const { return Struct.*Member; }
+};
+
+/// A field of a nested struct whose members are written inline in the outer object.
+template<typename OwnerType, typename InnerType, typename ValueType>
+struct TFlattenedMessageField
+{
+	FAnsiStringView Name;
+	InnerType OwnerType::* Outer;
+	ValueType InnerType::* Member;
+	bool bOptional;
+
+	template<typename StructType>
+	constexpr auto& Get(StructType& Struct) const { return (Struct.*Outer).*Member; }
+};
+
+template<typename OwnerType, typename ValueType, int32 N>
+constexpr TMessageField<OwnerType, ValueType> Field(const ANSICHAR (&Name)[N], ValueType OwnerType::* Member)
+{
+	return { FAnsiStringView(Name, N - 1), Member, false };
+}
+
+template<typename OwnerType, typename ValueType, int32 N>
+constexpr TMessageField<OwnerType, ValueType> OptionalField(const ANSICHAR (&Name)[N], ValueType OwnerType::* Member)
+{
+	return { FAnsiStringView(Name, N - 1), Member, true };
+}
+
+template<typename OwnerType, typename InnerType, typename ValueType>
+constexpr TFlattenedMessageField<OwnerType, InnerType, ValueType> Flatten(InnerType OwnerType::* Outer, const TMessageField<InnerType, ValueType>& InnerField)
+{
+	return { InnerField.Name, Outer, InnerField.Member, InnerField.bOptional };
+}
+
+/// Does this type declare its JSON members with BUTTPLUG_MESSAGE_FIELDS?
+template<typename StructType, typename = void>
+constexpr bool THasMessageFields = false;
+
+template<typename StructType>
+constexpr bool THasMessageFields<StructType, std::void_t<decltype(StructType::bHasMessageFields)>> = true;
+
+/// Does a key, as read or written, name this field? Compared code unit by code unit, since keys are plain ASCII.
+template<typename CharType>
+constexpr bool IsFieldNamed(FAnsiStringView Name, TStringView<CharType> Key)
+{
+	if (Name.Len() != Key.Len()) return false;
+	for (int32 Index = 0; Index < Name.Len(); ++Index)
+	{
+		if (static_cast<uint32>(Name.GetData()[Index]) != static_cast<uint32>(Key.GetData()[Index])) return false;
+	}
+	return true;
+}
+
+template<int32 NumBuckets>
+struct TFieldKeyBuckets
+{
+	/// The index of the field whose key hashes to each bucket, and that key, to confirm a match.
+	int8 Entries[NumBuckets] = {};
+	FAnsiStringView Names[NumBuckets] = {};
+	uint32 Seed = 0;
+	bool bPerfect = false;
+};
+
+template<typename StructType>
+constexpr int32 GetNumFields()
+{
+	return StructType::VisitFields([](const auto&... Fields) { return static_cast<int32>(sizeof...(Fields)); });
+}
+
+/// Hash StructType's keys as TEnumNameTable hashes enum names, searching for a seed under which none collide.
+/// Unlike enums, there's no seed to pick by hand; a message's handful of keys is quick to search at compile time.
+template<typename StructType, int32 HashBits>
+constexpr TFieldKeyBuckets<1 << HashBits> MakeFieldKeyBuckets()
+{
+	return StructType::VisitFields([](const auto&... Fields)
+	{
+		const FAnsiStringView Names[] = { Fields.Name..., FAnsiStringView() };
+		TFieldKeyBuckets<1 << HashBits> Buckets;
+		for (uint32 Seed = 0; Seed < 1024 && !Buckets.bPerfect; ++Seed)
+		{
+			Buckets.Seed = Seed;
+			Buckets.bPerfect = true;
+			for (int32 Bucket = 0; Bucket < (1 << HashBits); ++Bucket)
+			{
+				Buckets.Entries[Bucket] = INDEX_NONE;
+				Buckets.Names[Bucket] = FAnsiStringView();
+			}
+			for (int32 Index = 0; Index < static_cast<int32>(sizeof...(Fields)); ++Index)
+			{
+				int32 Bucket = HashEnumName(Names[Index].GetData(), Names[Index].Len(), Seed, HashBits);
+				Buckets.bPerfect &= Buckets.Entries[Bucket] == INDEX_NONE;
+				Buckets.Entries[Bucket] = static_cast<int8>(Index);
+				Buckets.Names[Bucket] = Names[Index];
+			}
+		}
+		return Buckets;
+	});
+}
+
+/// Compile-time, perfectly hashed table from a message struct's JSON keys to its fields, built like TEnumNameTable.
+template<typename StructType>
+struct TFieldKeyTable
+{
+	static constexpr int32 Num = GetNumFields<StructType>();
+	static_assert(Num <= 64, "Message field sets are tracked in a uint64, so can have at most 64 fields");
+
+	/// At least one bit, as HashEnumName can't shift by the whole hash.
+	static constexpr int32 HashBits = GetEnumNameHashBits(Num) > 0 ? GetEnumNameHashBits(Num) : 1;
+	static constexpr TFieldKeyBuckets<1 << HashBits> Buckets = MakeFieldKeyBuckets<StructType, HashBits>();
+	static_assert(Buckets.bPerfect, "No collision-free seed for these message keys; are two fields given the same key?");
+};
+
+/// The index of the field of StructType a key names, or INDEX_NONE. This is the lookup the reader decodes keys with:
+/// one hash and one compare against the only key that could match.
+template<typename StructType, typename CharType>
+constexpr int32 FindFieldIndex(TStringView<CharType> Key)
+{
+	using FTable = TFieldKeyTable<StructType>;
+	int32 Bucket = HashEnumName(Key.GetData(), Key.Len(), FTable::Buckets.Seed, FTable::HashBits);
+	if (FTable::Buckets.Entries[Bucket] == INDEX_NONE || !IsFieldNamed(FTable::Buckets.Names[Bucket], Key)) return INDEX_NONE;
+	return FTable::Buckets.Entries[Bucket];
+}
+
+/// Bit N is set if field N of StructType is required.
+template<typename StructType>
+constexpr uint64 GetRequiredFieldMask()
+{
+	return StructType::VisitFields([](const auto&... Fields)
+	{
+		uint64 Mask = 0;
+		int32 Index = 0;
+		((Mask |= (Fields.bOptional ? 0 : uint64(1) << Index), ++Index), ...);
+		return Mask;
+	});
+}
+
+/// Does the reader's FindFieldIndex map each nonempty key StructType writes back to the field it was written from?
+/// This checks keys only; values are written and read by runtime code, so aren't checked to read back equal.
+template<typename StructType>
+constexpr bool DoFieldKeysFindTheirFields()
+{
+	return StructType::VisitFields([](const auto&... Fields)
+	{
+		int32 Index = 0;
+		return ((Fields.Name.Len() != 0 && FindFieldIndex<StructType>(Fields.Name) == Index++) && ...);
+	});
+}
+
+} // namespace Buttplug::Private
+
+/**
+ * Declare the JSON members of a message struct, in the order they are written.
+ * Each argument is a Field, OptionalField or Flatten descriptor; Func is called with all of them.
+ */
+#define BUTTPLUG_MESSAGE_FIELDS(...) \
+	static constexpr bool bHasMessageFields = true; \
+	template<typename FunctionType> \
+	static constexpr decltype(auto) VisitFields(FunctionType&& Func) \
+	{ \
+		using namespace Buttplug::Private; \
+		return Func(__VA_ARGS__); \
+	}
@@ -0,0 +1,244 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugMessageTracker.h"
+
+#include "ButtplugSettings.h"
+#include "Misc/ScopeLock.h"
+
+void FButtplugLatencyHistogram::Record(double Latency)
+{
+	int32 Bucket = 0;
+	while (Bucket < NumBuckets - 1 && Latency >= FirstBucketLatency * (1 << Bucket))
+	{
+		++Bucket;
+	}
+	++Buckets[Bucket];
+	++Count;
+	TotalLatency += Latency;
+	MaxLatency = FMath::Max(MaxLatency, Latency);
+}
+
+double FButtplugLatencyHistogram::GetPercentile(double Fraction) const
+{
+	if (Count == 0) return 0.0;
+	uint32 Target = FMath::Max(1u, static_cast<uint32>(FMath::CeilToInt64(Count * Fraction)));
+	uint32 Seen = 0;
+	for (int32 Bucket = 0; Bucket < NumBuckets - 1; ++Bucket)
+	{
+		Seen += Buckets[Bucket];
+		if (Seen >= Target) return FMath::Min(FirstBucketLatency * (1 << Bucket), MaxLatency);
+	}
+	return MaxLatency;
+}
+
+FButtplugLatencyStats FButtplugLatencyHistogram::GetStats() const
+{
+	// Reported in milliseconds.
+	FButtplugLatencyStats Stats;
+	Stats.Count = Count;
+	Stats.ErrorCount = ErrorCount;
+	Stats.TimeoutCount = TimeoutCount;
+	Stats.Mean = Count ? static_cast<float>(TotalLatency / Count * 1000.0) : 0.0f;
+	Stats.Median = static_cast<float>(GetPercentile(0.5) * 1000.0);
+	Stats.P99 = static_cast<float>(GetPercentile(0.99) * 1000.0);
+	Stats.Max = static_cast<float>(MaxLatency * 1000.0);
+	return Stats;
+}
+
+void FButtplugSendRateController::SetLimits(double MinInterval, double MaxInterval)
+{
+	// A device without a timing gap still shouldn't be sent to faster than this.
+	constexpr double ShortestInterval = 0.001;
+	MaxRate = 1.0 / FMath::Max(MinInterval, ShortestInterval);
+	MinRate = FMath::Min(1.0 / FMath::Max(MaxInterval, ShortestInterval), MaxRate);
+	Rate = Rate == 0.0 ? MaxRate : FMath::Clamp(Rate, MinRate, MaxRate);
+}
+
+void FButtplugSendRateController::OnReply(double Latency, double LatencyTarget, double Now)
+{
+	if (Latency > LatencyTarget)
+	{
+		Decrease(Now, Latency);
+	}
+	else
+	{
+		Rate = FMath::Min(Rate + AdditiveIncrease, MaxRate);
+	}
+}
+
+void FButtplugSendRateController::OnTimeout(double Now, double Timeout)
+{
+	Decrease(Now, Timeout);
+}
+
+void FButtplugSendRateController::Decrease(double Now, double RoundTrip)
+{
+	// Replies to everything sent during one round trip come back slow together; only back off once for them.
+	if (Now - LastDecreaseTime < RoundTrip) return;
+	LastDecreaseTime = Now;
+	Rate = FMath::Max(Rate * MultiplicativeDecrease, MinRate);
+}
+
+template<typename FunctionType>
+void FButtplugMessageTracker::ForEachHistogram(const FInFlightMessage& Message, FunctionType&& Func)
+{
+	Func(Histogram);
+	Func(MessageTypeHistograms[static_cast<int32>(Message.MessageType)]);
+	if (Message.DeviceIndex.IsSet())
+	{
+		Func(DeviceHistograms.FindOrAdd(Message.DeviceIndex.GetValue()));
+	}
+	if (Message.MessageType == EButtplugMessageType::StopDeviceCmd || Message.MessageType == EButtplugMessageType::StopAllDevices)
+	{
+		Func(StopHistogram);
+	}
+}
+
+void FButtplugMessageTracker::SetFailedCallback(uint32 Id, FButtplugMessageFailedFunction&& OnFailed)
+{
+	FScopeLock ScopeLock(&Lock);
+	PendingCallbacks.Add(Id, MoveTemp(OnFailed));
+}
+
+void FButtplugMessageTracker::Track(const FButtplugMessageArray& Messages, double SendTime)
+{
+	FScopeLock ScopeLock(&Lock);
+	for (const FButtplugMessageVariant& Message : Messages)
+	{
+		uint32 Id = Message.GetMessage().Id;
+		FInFlightMessage& Entry = InFlight.Add(Id);
+		Entry.SendTime = SendTime;
+		Entry.MessageType = Message.GetMessageType();
+		Entry.DeviceIndex = Message.GetDeviceIndex();
+		PendingCallbacks.RemoveAndCopyValue(Id, Entry.OnFailed);
+	}
+}
+
+FButtplugMessageFailedFunction FButtplugMessageTracker::Complete(uint32 Id, double ReceiveTime, bool bFailed)
+{
+	FScopeLock ScopeLock(&Lock);
+	FInFlightMessage Message;
+	if (!InFlight.RemoveAndCopyValue(Id, Message))
+	{
+		// Server initiated (Id 0), already timed out, or from before a reset.
+		return nullptr;
+	}
+
+	double Latency = ReceiveTime - Message.SendTime;
+	ForEachHistogram(Message, [&](FButtplugLatencyHistogram& Histogram)
+	{
+		Histogram.Record(Latency);
+		Histogram.ErrorCount += bFailed;
+	});
+	if (FButtplugSendRateController* SendRate = Message.DeviceIndex.IsSet() ? DeviceSendRates.Find(Message.DeviceIndex.GetValue()) : nullptr)
+	{
+		SendRate->OnReply(Latency, GetDefault<UButtplugSettings>()->SendRateLatencyTarget, ReceiveTime);
+	}
+	if (!bFailed) return nullptr;
+	return MoveTemp(Message.OnFailed);
+}
+
+void FButtplugMessageTracker::ExpireTimeouts(double Now, double Timeout, TArray<FButtplugMessageFailedFunction>& OutOnFailed)
+{
+	FScopeLock ScopeLock(&Lock);
+	for (auto It = InFlight.CreateIterator(); It; ++It)
+	{
+		FInFlightMessage& Message = It.Value();
+		if (Now - Message.SendTime >= Timeout)
+		{
+			ForEachHistogram(Message, [](FButtplugLatencyHistogram& Histogram) { ++Histogram.TimeoutCount; });
+			if (FButtplugSendRateController* SendRate = Message.DeviceIndex.IsSet() ? DeviceSendRates.Find(Message.DeviceIndex.GetValue()) : nullptr)
+			{
+				SendRate->OnTimeout(Now, Timeout);
+			}
+			if (Message.OnFailed) OutOnFailed.Add(MoveTemp(Message.OnFailed));
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void FButtplugMessageTracker::Reset(TArray<FButtplugMessageFailedFunction>& OutOnFailed)
+{
+	FScopeLock ScopeLock(&Lock);
+	for (TPair<uint32, FInFlightMessage>& Entry : InFlight)
+	{
+		if (Entry.Value.OnFailed) OutOnFailed.Add(MoveTemp(Entry.Value.OnFailed));
+	}
+	for (TPair<uint32, FButtplugMessageFailedFunction>& Entry : PendingCallbacks)
+	{
+		OutOnFailed.Add(MoveTemp(Entry.Value));
+	}
+	for (FButtplugMessageFailedFunction& OnFailed : DroppedCallbacks)
+	{
+		OutOnFailed.Add(MoveTemp(OnFailed));
+	}
+	InFlight.Reset();
+	PendingCallbacks.Reset();
+	DroppedCallbacks.Reset();
+}
+
+void FButtplugMessageTracker::Drop(uint32 Id)
+{
+	FScopeLock ScopeLock(&Lock);
+	FButtplugMessageFailedFunction OnFailed;
+	if (PendingCallbacks.RemoveAndCopyValue(Id, OnFailed))
+	{
+		DroppedCallbacks.Add(MoveTemp(OnFailed));
+	}
+}
+
+void FButtplugMessageTracker::TakeDropped(TArray<FButtplugMessageFailedFunction>& OutOnFailed)
+{
+	FScopeLock ScopeLock(&Lock);
+	for (FButtplugMessageFailedFunction& OnFailed : DroppedCallbacks)
+	{
+		OutOnFailed.Add(MoveTemp(OnFailed));
+	}
+	DroppedCallbacks.Reset();
+}
+
+int32 FButtplugMessageTracker::GetNumInFlight() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return InFlight.Num();
+}
+
+FButtplugLatencyStats FButtplugMessageTracker::GetStats() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return Histogram.GetStats();
+}
+
+FButtplugLatencyStats FButtplugMessageTracker::GetDeviceStats(uint32 DeviceIndex) const
+{
+	FScopeLock ScopeLock(&Lock);
+	const FButtplugLatencyHistogram* DeviceHistogram = DeviceHistograms.Find(DeviceIndex);
+	return DeviceHistogram ? DeviceHistogram->GetStats() : FButtplugLatencyStats();
+}
+
+FButtplugLatencyStats FButtplugMessageTracker::GetMessageTypeStats(EButtplugMessageType MessageType) const
+{
+	FScopeLock ScopeLock(&Lock);
+	return MessageTypeHistograms[static_cast<int32>(MessageType)].GetStats();
+}
+
+FButtplugLatencyStats FButtplugMessageTracker::GetStopStats() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return StopHistogram.GetStats();
+}
+
+void FButtplugMessageTracker::SetDeviceSendIntervalLimits(uint32 DeviceIndex, double MinInterval, double MaxInterval)
+{
+	FScopeLock ScopeLock(&Lock);
+	DeviceSendRates.FindOrAdd(DeviceIndex).SetLimits(MinInterval, MaxInterval);
+}
+
+double FButtplugMessageTracker::GetDeviceSendInterval(uint32 DeviceIndex, double MinInterval) const
+{
+	if (!GetDefault<UButtplugSettings>()->bAdaptiveSendRate) return MinInterval;
+
+	FScopeLock ScopeLock(&Lock);
+	const FButtplugSendRateController* SendRate = DeviceSendRates.Find(DeviceIndex);
+	return SendRate ? FMath::Max(SendRate->GetInterval(), MinInterval) : MinInterval;
+}
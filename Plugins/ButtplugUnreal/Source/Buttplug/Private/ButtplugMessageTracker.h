@@ -0,0 +1,114 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "ButtplugDevice.h"
+#include "ButtplugMessage.h"
+#include "HAL/CriticalSection.h"
+
+/// Log-scale histogram of message round trip latencies.
+struct FButtplugLatencyHistogram
+{
+	static constexpr int32 NumBuckets = 16;
+	/// Upper bound of the first bucket; each following bucket doubles it. The last bucket also counts everything slower.
+	static constexpr double FirstBucketLatency = 0.00025;
+
+	uint32 Buckets[NumBuckets] = {};
+	uint32 Count = 0;
+	uint32 ErrorCount = 0;
+	uint32 TimeoutCount = 0;
+	double TotalLatency = 0.0;
+	double MaxLatency = 0.0;
+
+	void Record(double Latency);
+	/// Upper bound of the bucket containing the given fraction of recorded latencies.
+	double GetPercentile(double Fraction) const;
+	FButtplugLatencyStats GetStats() const;
+};
+
+/// Additive-increase, multiplicative-decrease control of a device's send rate from its measured round trips.
+/// Fast replies raise the rate a step at a time; slow replies or timeouts halve it, at most once per round trip.
+struct FButtplugSendRateController
+{
+	/// Messages per second gained for each reply under the latency target.
+	static constexpr double AdditiveIncrease = 1.0;
+	static constexpr double MultiplicativeDecrease = 0.5;
+
+	double MinRate = 0.0;
+	double MaxRate = 0.0;
+	double Rate = 0.0;
+	double LastDecreaseTime = 0.0;
+
+	/// @param MinInterval The device's advertised timing gap; the rate never goes above this allows.
+	/// @param MaxInterval The slowest the rate goes.
+	void SetLimits(double MinInterval, double MaxInterval);
+	void OnReply(double Latency, double LatencyTarget, double Now);
+	void OnTimeout(double Now, double Timeout);
+	double GetInterval() const { return 1.0 / Rate; }
+
+private:
+	void Decrease(double Now, double RoundTrip);
+};
+
+/// Matches server replies to the messages they answer, by Id, measuring round trip latency per device and per message type.
+/// Safe to use from any thread; failure callbacks are only ever returned to the caller to run.
+class FButtplugMessageTracker
+{
+public:
+	/// Attach a callback to a message that has been queued but not yet sent.
+	void SetFailedCallback(uint32 Id, FButtplugMessageFailedFunction&& OnFailed);
+	/// Start tracking a batch of messages as it is sent.
+	void Track(const FButtplugMessageArray& Messages, double SendTime);
+	/// Complete the message with this Id, recording its round trip.
+	/// @return The message's failure callback if the reply was an error and it had one.
+	FButtplugMessageFailedFunction Complete(uint32 Id, double ReceiveTime, bool bFailed);
+	/// Stop tracking messages sent longer than Timeout ago, collecting their failure callbacks.
+	void ExpireTimeouts(double Now, double Timeout, TArray<FButtplugMessageFailedFunction>& OutOnFailed);
+	/// Stop tracking all messages, collecting their failure callbacks. Statistics are kept.
+	void Reset(TArray<FButtplugMessageFailedFunction>& OutOnFailed);
+	/// Note that a queued message was dropped without being sent. Its failure callback is kept until TakeDropped.
+	void Drop(uint32 Id);
+	/// Collect the failure callbacks of dropped messages.
+	void TakeDropped(TArray<FButtplugMessageFailedFunction>& OutOnFailed);
+
+	/// Number of sent messages still waiting for a reply.
+	int32 GetNumInFlight() const;
+	FButtplugLatencyStats GetStats() const;
+	FButtplugLatencyStats GetDeviceStats(uint32 DeviceIndex) const;
+	FButtplugLatencyStats GetMessageTypeStats(EButtplugMessageType MessageType) const;
+	/// Round trip of StopDeviceCmd and StopAllDevices together.
+	FButtplugLatencyStats GetStopStats() const;
+
+	/// Set the range a device's adaptive send interval can move in.
+	void SetDeviceSendIntervalLimits(uint32 DeviceIndex, double MinInterval, double MaxInterval);
+	/// The adaptive interval between sends to a device, or MinInterval if adaptive rate control is disabled.
+	double GetDeviceSendInterval(uint32 DeviceIndex, double MinInterval) const;
+
+private:
+	struct FInFlightMessage
+	{
+		double SendTime = 0.0;
+		EButtplugMessageType MessageType = {};
+		TOptional<uint32> DeviceIndex;
+		FButtplugMessageFailedFunction OnFailed;
+	};
+
+	template<typename FunctionType>
+	void ForEachHistogram(const FInFlightMessage& Message, FunctionType&& Func);
+
+	mutable FCriticalSection Lock;
+	TMap<uint32, FInFlightMessage> InFlight;
+	/// Callbacks for messages that haven't been sent yet.
+	TMap<uint32, FButtplugMessageFailedFunction> PendingCallbacks;
+	/// Callbacks for messages that were dropped without being sent.
+	TArray<FButtplugMessageFailedFunction> DroppedCallbacks;
+
+	FButtplugLatencyHistogram Histogram;
+	TMap<uint32, FButtplugLatencyHistogram> DeviceHistograms;
+	FButtplugLatencyHistogram StopHistogram;
+	TMap<uint32, FButtplugSendRateController> DeviceSendRates;
+	FButtplugLatencyHistogram MessageTypeHistograms[Buttplug::Private::TEnumNameTable<EButtplugMessageType>::Num];
+};
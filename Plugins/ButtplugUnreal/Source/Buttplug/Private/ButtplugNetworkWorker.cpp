@@ -0,0 +1,103 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugNetworkWorker.h"
+
+#include "ButtplugMessageTracker.h"
+#include "HAL/Event.h"
+#include "HAL/RunnableThread.h"
+#include "IWebSocket.h"
+#include "Logging/StructuredLog.h"
+
+FButtplugNetworkWorker::FButtplugNetworkWorker(TSharedRef<IWebSocket> InWebSocket, FButtplugMessageTracker& InMessageTracker)
+	: WebSocket(MoveTemp(InWebSocket))
+	, MessageTracker(InMessageTracker)
+{
+	WakeEvent = FPlatformProcess::GetSynchEventFromPool();
+	Thread = FRunnableThread::Create(this, TEXT("ButtplugNetworkWorker"), 0, TPri_AboveNormal);
+}
+
+FButtplugNetworkWorker::~FButtplugNetworkWorker()
+{
+	if (Thread)
+	{
+		Thread->Kill(/*bShouldWait:*/true);
+		delete Thread;
+	}
+	FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+}
+
+void FButtplugNetworkWorker::SendMessages(FButtplugMessageArray& Messages)
+{
+	OutgoingBatches.Enqueue(MoveTemp(Messages));
+	Messages.Reset();
+	SpentBatches.Dequeue(Messages);
+	WakeEvent->Trigger();
+}
+
+void FButtplugNetworkWorker::ReceiveFrame(const FString& Frame)
+{
+	IncomingFrames.Enqueue(Frame);
+	WakeEvent->Trigger();
+}
+
+bool FButtplugNetworkWorker::DequeueMessages(FButtplugMessageArray& OutMessages)
+{
+	return IncomingBatches.Dequeue(OutMessages);
+}
+
+uint32 FButtplugNetworkWorker::Run()
+{
+	while (!bStopping.load(std::memory_order_relaxed))
+	{
+		WakeEvent->Wait();
+		ProcessIncoming();
+		ProcessOutgoing();
+	}
+	return 0;
+}
+
+void FButtplugNetworkWorker::Stop()
+{
+	bStopping.store(true, std::memory_order_relaxed);
+	WakeEvent->Trigger();
+}
+
+void FButtplugNetworkWorker::ProcessOutgoing()
+{
+	FButtplugMessageArray Batch;
+	while (OutgoingBatches.Dequeue(Batch))
+	{
+		WriteButtplugMessagesToJson(Batch, SendBuffer);
+		WebSocket->Send(SendBuffer.GetData(), SendBuffer.Num(), /*bIsBinary:*/false);
+		Batch.Reset();
+		SpentBatches.Enqueue(MoveTemp(Batch));
+	}
+}
+
+void FButtplugNetworkWorker::ProcessIncoming()
+{
+	FString Frame;
+	while (IncomingFrames.Dequeue(Frame))
+	{
+		FButtplugMessageArray Messages;
+		ReadButtplugMessagesFromJson(Frame, Messages);
+
+		// Acknowledgements need nothing from the game thread, so complete them here and don't send them across.
+		double ReceiveTime = FPlatformTime::Seconds();
+		Messages.RemoveAll([this, ReceiveTime](const FButtplugMessageVariant& Message)
+		{
+			if (const FButtplugMessage::Ok* Ok = Message.TryGet<FButtplugMessage::Ok>())
+			{
+				UE_LOGFMT(LogButtplug, VeryVerbose, "Buttplug server okayed message {Id}", Ok->Id);
+				MessageTracker.Complete(Ok->Id, ReceiveTime, /*bFailed:*/false);
+				return true;
+			}
+			return false;
+		});
+
+		if (!Messages.IsEmpty())
+		{
+			IncomingBatches.Enqueue(MoveTemp(Messages));
+		}
+	}
+}
@@ -0,0 +1,64 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "ButtplugMessage.h"
+#include "Containers/Queue.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+
+class FButtplugMessageTracker;
+class IWebSocket;
+
+/// Encodes, decodes and sends Buttplug messages on a dedicated thread.
+/// The game thread hands over outgoing batches and raw socket frames through single-producer queues,
+/// and gets back only the decoded server messages that it needs to act on.
+class FButtplugNetworkWorker : public FRunnable
+{
+public:
+	/// @param InMessageTracker Completed directly from the worker for replies that don't need the game thread.
+	FButtplugNetworkWorker(TSharedRef<IWebSocket> InWebSocket, FButtplugMessageTracker& InMessageTracker);
+	/// Stops and joins the worker thread.
+	virtual ~FButtplugNetworkWorker() override;
+
+	// Game thread interface
+public:
+	/// Hand a batch of messages to the worker to send. Messages is replaced with a previously sent batch, if any, to reuse its allocation.
+	void SendMessages(FButtplugMessageArray& Messages);
+	/// Hand a raw socket frame to the worker to decode.
+	void ReceiveFrame(const FString& Frame);
+	/// Take the next batch of decoded server messages. Returns false if there are none.
+	bool DequeueMessages(FButtplugMessageArray& OutMessages);
+
+	// FRunnable implementation
+public:
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	void ProcessOutgoing();
+	void ProcessIncoming();
+
+private:
+	TSharedRef<IWebSocket> WebSocket;
+	FButtplugMessageTracker& MessageTracker;
+	FRunnableThread* Thread = nullptr;
+	FEvent* WakeEvent = nullptr;
+	std::atomic<bool> bStopping = false;
+
+	/// Game thread to worker: batches waiting to be encoded and sent.
+	TQueue<FButtplugMessageArray, EQueueMode::Spsc> OutgoingBatches;
+	/// Worker to game thread: sent batches, emptied, so that their allocation can be reused.
+	TQueue<FButtplugMessageArray, EQueueMode::Spsc> SpentBatches;
+	/// Game thread to worker: socket frames waiting to be decoded.
+	TQueue<FString, EQueueMode::Spsc> IncomingFrames;
+	/// Worker to game thread: decoded server messages.
+	TQueue<FButtplugMessageArray, EQueueMode::Spsc> IncomingBatches;
+
+	/// UTF-8 encoded outgoing batch, only touched by the worker.
+	TArray<ANSICHAR> SendBuffer;
+};
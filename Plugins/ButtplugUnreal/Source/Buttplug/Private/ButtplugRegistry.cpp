@@ -0,0 +1,43 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugRegistry.h"
+
+FButtplugRegistry::FReadScope::FReadScope(const FButtplugRegistry& InRegistry)
+	: Registry(InRegistry)
+{
+	// Counted before loading, so that Reclaim can't miss a reader that got the previous snapshot.
+	Registry.NumReaders.fetch_add(1);
+	Snapshot = Registry.Current.load();
+}
+
+FButtplugRegistry::FReadScope::~FReadScope()
+{
+	Registry.NumReaders.fetch_sub(1);
+}
+
+FButtplugRegistry::FButtplugRegistry()
+	: Published(MakeUnique<FButtplugRegistrySnapshot>())
+{
+	Current.store(Published.Get());
+}
+
+FButtplugRegistry::~FButtplugRegistry()
+{
+	check(NumReaders.load() == 0);
+}
+
+void FButtplugRegistry::Publish(FButtplugRegistrySnapshot&& Snapshot)
+{
+	check(IsInGameThread());
+	Retired.Add(MoveTemp(Published));
+	Published = MakeUnique<FButtplugRegistrySnapshot>(MoveTemp(Snapshot));
+	Current.store(Published.Get());
+	Reclaim();
+}
+
+void FButtplugRegistry::Reclaim()
+{
+	// Readers that start after Current was replaced can only load the new snapshot, so once none are counted, none hold a retired one.
+	if (Retired.IsEmpty() || NumReaders.load() != 0) return;
+	Retired.Reset();
+}
@@ -0,0 +1,136 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugSensorHistory.h"
+
+void FButtplugSensorHistory::Init(int32 InCapacity, int32 InNumChannels)
+{
+	check(InCapacity > 0 && InNumChannels >= 0);
+	Capacity = InCapacity;
+	NumChannels = InNumChannels;
+	Samples.SetNumZeroed(Capacity * NumChannels);
+	Times.SetNumZeroed(Capacity);
+	Sums.SetNum(NumChannels);
+	Mins.SetNum(NumChannels);
+	Maxes.SetNum(NumChannels);
+	StaleExtremes.Init(false, NumChannels);
+	Reset();
+}
+
+void FButtplugSensorHistory::Reset()
+{
+	Next = 0;
+	Count = 0;
+	for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+	{
+		Sums[Channel] = 0;
+		Mins[Channel] = MAX_int32;
+		Maxes[Channel] = MIN_int32;
+	}
+	StaleExtremes.SetRange(0, NumChannels, false);
+}
+
+void FButtplugSensorHistory::Add(TArrayView<const int32> Reading, double Time)
+{
+	check(Capacity > 0 && Reading.Num() == NumChannels);
+	bool bEvicting = Count == Capacity;
+	int32* Sample = &Samples[Next * NumChannels];
+	for (int32 Channel = 0; Channel < NumChannels; ++Channel)
+	{
+		if (bEvicting)
+		{
+			int32 Evicted = Sample[Channel];
+			Sums[Channel] -= Evicted;
+			if (Evicted == Mins[Channel] || Evicted == Maxes[Channel])
+			{
+				StaleExtremes[Channel] = true;
+			}
+		}
+
+		int32 Value = Reading[Channel];
+		Sample[Channel] = Value;
+		Sums[Channel] += Value;
+		Mins[Channel] = FMath::Min(Mins[Channel], Value);
+		Maxes[Channel] = FMath::Max(Maxes[Channel], Value);
+	}
+	Times[Next] = Time;
+	Next = (Next + 1) % Capacity;
+	Count = FMath::Min(Count + 1, Capacity);
+}
+
+TArrayView<const int32> FButtplugSensorHistory::GetReading(int32 Age) const
+{
+	check(Age >= 0 && Age < Count);
+	return TArrayView<const int32>(&Samples[GetSlot(Age) * NumChannels], NumChannels);
+}
+
+double FButtplugSensorHistory::GetTime(int32 Age) const
+{
+	check(Age >= 0 && Age < Count);
+	return Times[GetSlot(Age)];
+}
+
+void FButtplugSensorHistory::GetSpans(TArrayView<const int32>& OutOlder, TArrayView<const int32>& OutNewer) const
+{
+	if (IsEmpty())
+	{
+		OutOlder = {};
+		OutNewer = {};
+		return;
+	}
+
+	int32 Oldest = GetSlot(Count - 1);
+	if (Oldest + Count <= Capacity)
+	{
+		OutOlder = TArrayView<const int32>(Samples.GetData() + Oldest * NumChannels, Count * NumChannels);
+		OutNewer = {};
+	}
+	else
+	{
+		OutOlder = TArrayView<const int32>(Samples.GetData() + Oldest * NumChannels, (Capacity - Oldest) * NumChannels);
+		OutNewer = TArrayView<const int32>(Samples.GetData(), Next * NumChannels);
+	}
+}
+
+double FButtplugSensorHistory::GetAverage(int32 Channel) const
+{
+	if (IsEmpty() || !Sums.IsValidIndex(Channel)) return 0.0;
+	return Sums[Channel] / double(Count);
+}
+
+int32 FButtplugSensorHistory::GetMin(int32 Channel) const
+{
+	if (IsEmpty() || !Mins.IsValidIndex(Channel)) return 0;
+	if (StaleExtremes[Channel]) RescanExtremes(Channel);
+	return Mins[Channel];
+}
+
+int32 FButtplugSensorHistory::GetMax(int32 Channel) const
+{
+	if (IsEmpty() || !Maxes.IsValidIndex(Channel)) return 0;
+	if (StaleExtremes[Channel]) RescanExtremes(Channel);
+	return Maxes[Channel];
+}
+
+double FButtplugSensorHistory::GetRateOfChange(int32 Channel) const
+{
+	if (Count < 2 || Channel < 0 || Channel >= NumChannels) return 0.0;
+	double Elapsed = GetTime(0) - GetTime(Count - 1);
+	if (Elapsed <= 0.0) return 0.0;
+	return (GetReading(0)[Channel] - GetReading(Count - 1)[Channel]) / Elapsed;
+}
+
+void FButtplugSensorHistory::RescanExtremes(int32 Channel) const
+{
+	// Only needed when an extreme is evicted, so amortized over the readings that pushed it out.
+	int32 Min = MAX_int32;
+	int32 Max = MIN_int32;
+	for (int32 Age = 0; Age < Count; ++Age)
+	{
+		int32 Value = Samples[GetSlot(Age) * NumChannels + Channel];
+		Min = FMath::Min(Min, Value);
+		Max = FMath::Max(Max, Value);
+	}
+	Mins[Channel] = Min;
+	Maxes[Channel] = Max;
+	StaleExtremes[Channel] = false;
+}
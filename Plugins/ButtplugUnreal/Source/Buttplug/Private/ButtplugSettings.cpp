@@ -0,0 +1,9 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugSettings.h"
+
+UButtplugSettings::UButtplugSettings(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	CategoryName = TEXT("Plugins");
+}
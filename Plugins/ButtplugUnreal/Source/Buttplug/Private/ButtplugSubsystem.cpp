@@ -7,7 +7,12 @@
 #include "ButtplugDevice.h"
 #include "ButtplugEvents.h"
 #include "ButtplugFeature.h"
+#include "ButtplugFeatureStore.h"
+#include "ButtplugHapticsClock.h"
 #include "ButtplugMessage.h"
+#include "ButtplugMessageTracker.h"
+#include "ButtplugNetworkWorker.h"
+#include "ButtplugSettings.h"
 #include "Engine/Engine.h"
 #include "IWebSocket.h"
 #include "Logging/LogMacros.h"
@@ -67,10 +72,21 @@ private:
 	FString& ErrorMessage;
 };
 
+UButtplugSubsystem::UButtplugSubsystem() = default;
+
+UButtplugSubsystem::UButtplugSubsystem(FVTableHelper& Helper)
+	: Super(Helper)
+{
+}
+
+UButtplugSubsystem::~UButtplugSubsystem() = default;
+
 void UButtplugSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 {
 	bInitialized = true;
 	ClientName = FApp::GetName();
+	MessageTracker = MakeUnique<FButtplugMessageTracker>();
+	FeatureStore = MakeUnique<FButtplugFeatureStore>();
 
 	UGameInstance* GameInstance = GetGameInstance();
 	if (GameInstance->Implements<IButtplugEvents::UClassType>())
@@ -88,6 +104,8 @@ void UButtplugSubsystem::Deinitialize()
 {
 	Reset("Shutting down");
 	ClientName.Empty();
+	MessageTracker.Reset();
+	FeatureStore.Reset();
 	bInitialized = false;
 }
 
@@ -131,14 +149,165 @@ void UButtplugSubsystem::GetAllDevices(TArray<UButtplugDevice*>& OutDevices) con
 	}
 }
 
+FButtplugHapticsClockStats UButtplugSubsystem::GetHapticsClockStats() const
+{
+	return HapticsClock ? HapticsClock->GetStats() : FButtplugHapticsClockStats();
+}
+
+FButtplugLatencyStats UButtplugSubsystem::GetLatencyStats() const
+{
+	return MessageTracker->GetStats();
+}
+
+FButtplugLatencyStats UButtplugSubsystem::GetDeviceLatencyStats(uint32 DeviceIndex) const
+{
+	return MessageTracker->GetDeviceStats(DeviceIndex);
+}
+
+FButtplugLatencyStats UButtplugSubsystem::GetMessageTypeLatencyStats(EButtplugMessageType MessageType) const
+{
+	return MessageTracker->GetMessageTypeStats(MessageType);
+}
+
+FButtplugLatencyStats UButtplugSubsystem::GetTimeToStopStats() const
+{
+	// Stops are sent as soon as they are requested, so their round trip is the whole time to stop.
+	return MessageTracker->GetStopStats();
+}
+
+void UButtplugSubsystem::SetDeviceSendIntervalLimits(uint32 DeviceIndex, double MinInterval, double MaxInterval)
+{
+	MessageTracker->SetDeviceSendIntervalLimits(DeviceIndex, MinInterval, MaxInterval);
+}
+
+double UButtplugSubsystem::GetDeviceSendInterval(uint32 DeviceIndex, double MinInterval) const
+{
+	return MessageTracker->GetDeviceSendInterval(DeviceIndex, MinInterval);
+}
+
+bool UButtplugSubsystem::IsCongested() const
+{
+	return bReportedCongested;
+}
+
+int32 UButtplugSubsystem::GetNumMessagesInFlight() const
+{
+	return MessageTracker->GetNumInFlight();
+}
+
+int64 UButtplugSubsystem::GetDroppedMessageCount() const
+{
+	return DroppedMessageCount.load(std::memory_order_relaxed);
+}
+
 void UButtplugSubsystem::StartScanning()
 {
-	EnqueueMessage(MakeUnique<FButtplugMessage::StartScanning>());
+	EnqueueMessage(FButtplugMessage::StartScanning());
 }
 
 void UButtplugSubsystem::StopScanning()
 {
-	EnqueueMessage(MakeUnique<FButtplugMessage::StopScanning>());
+	EnqueueMessage(FButtplugMessage::StopScanning());
+}
+
+void UButtplugSubsystem::StopAllDevices()
+{
+	if (!IsConnected()) return;
+
+	FScopeLock Lock(&HapticsLock);
+	// Merge first, so that actuation submitted before the stop can't restart a device after it.
+	DrainSubmissions();
+	for (const TPair<int32, TObjectPtr<UButtplugDevice>>& DeviceEntry : Devices)
+	{
+		DeviceEntry.Value->CancelQueuedActuation();
+	}
+	SendPriorityMessage(FButtplugMessage::StopAllDevices(), [](const FString& Reason)
+	{
+		UE_LOGFMT(LogButtplug, Warning, "Failed to stop all Buttplug devices: {Reason}", Reason);
+	});
+}
+
+FButtplugDeviceHandle UButtplugSubsystem::GetDeviceHandle(const UButtplugDevice* Device) const
+{
+	return Device ? Device->GetHandle() : FButtplugDeviceHandle();
+}
+
+FButtplugFeatureHandle UButtplugSubsystem::GetFeatureHandle(const UButtplugFeature* Feature) const
+{
+	return Feature ? Feature->GetHandle() : FButtplugFeatureHandle();
+}
+
+FButtplugFeatureHandle UButtplugSubsystem::FindFeature(FButtplugDeviceHandle Device, EButtplugFeatureType FeatureType, int32 Nth) const
+{
+	FScopeLock Lock(&HapticsLock);
+	if (!FeatureStore->IsValid(Device)) return {};
+	const FButtplugFeatureStore::FDeviceSlot& Slot = FeatureStore->DeviceSlots[Device.Slot];
+	for (int32 Row = Slot.FirstRow; Row < Slot.FirstRow + Slot.NumRows; ++Row)
+	{
+		if (FeatureStore->FeatureTypes[Row] == FeatureType && Nth-- == 0)
+		{
+			return FeatureStore->GetFeatureHandle(Row);
+		}
+	}
+	return {};
+}
+
+bool UButtplugSubsystem::IsHandleValid(FButtplugDeviceHandle Device) const
+{
+	FScopeLock Lock(&HapticsLock);
+	return FeatureStore->IsValid(Device);
+}
+
+bool UButtplugSubsystem::IsHandleValid(FButtplugFeatureHandle Feature) const
+{
+	FScopeLock Lock(&HapticsLock);
+	return FeatureStore->IsValid(Feature);
+}
+
+bool UButtplugSubsystem::IsDeviceConnected(FButtplugDeviceHandle Device) const
+{
+	FScopeLock Lock(&HapticsLock);
+	return FeatureStore->IsValid(Device) && FeatureStore->DeviceSlots[Device.Slot].bConnected;
+}
+
+bool UButtplugSubsystem::Actuate(FButtplugFeatureHandle Feature, double Value, float Duration)
+{
+	if (!Feature.IsSet()) return false;
+	SubmittedActuations.Enqueue({ Feature, Value, Duration, FPlatformTime::Seconds() });
+	return true;
+}
+
+bool UButtplugSubsystem::Read(FButtplugFeatureHandle Feature)
+{
+	FScopeLock Lock(&HapticsLock);
+	if (!FeatureStore->IsValid(Feature) || FeatureStore->CmdTypes[Feature.Row] != EButtplugMessageType::SensorReadCmd) return false;
+	const FButtplugFeatureStore::FDeviceSlot& Slot = FeatureStore->DeviceSlots[FeatureStore->RowSlots[Feature.Row]];
+	if (!Slot.bConnected) return false;
+
+	FButtplugMessage::SensorReadCmd ReadCmd;
+	ReadCmd.DeviceIndex = Slot.DeviceIndex;
+	ReadCmd.SensorIndex = FeatureStore->CmdIndices[Feature.Row];
+	ReadCmd.SensorType = FeatureStore->FeatureTypes[Feature.Row];
+	EnqueueMessage(MoveTemp(ReadCmd));
+	return true;
+}
+
+bool UButtplugSubsystem::StopDevice(FButtplugDeviceHandle Device)
+{
+	FScopeLock Lock(&HapticsLock);
+	if (!IsConnected() || !FeatureStore->IsValid(Device) || !FeatureStore->DeviceSlots[Device.Slot].bConnected) return false;
+	DrainSubmissions();
+	FeatureStore->CancelQueued(Device.Slot);
+
+	// Sent right away rather than waiting for the next flush and the device's timing gap.
+	uint32 DeviceIndex = FeatureStore->DeviceSlots[Device.Slot].DeviceIndex;
+	FButtplugMessage::StopDeviceCmd StopCmd;
+	StopCmd.DeviceIndex = DeviceIndex;
+	SendPriorityMessage(MoveTemp(StopCmd), [DeviceIndex](const FString& Reason)
+	{
+		UE_LOGFMT(LogButtplug, Warning, "Failed to stop Buttplug device {Index}: {Reason}", DeviceIndex, Reason);
+	});
+	return true;
 }
 
 void UButtplugSubsystem::AsyncStartClient(FLatentActionInfo LatentInfo, EButtplugClientStartResult& OutResult, FString& OutErrorMessage, const FString& InClientName, const FString& InServerAddress)
@@ -214,22 +383,113 @@ void UButtplugSubsystem::StopClient()
 
 void UButtplugSubsystem::Tick(float DeltaTime)
 {
+	Registry.Reclaim();
 	if (IsConnected())
 	{
 		for (const TPair<int32, TObjectPtr<UButtplugDevice>>& DeviceEntry : Devices)
 		{
-			TObjectPtr<UButtplugDevice> Device = DeviceEntry.Value;
-			Device->FlushMessageQueue(DeltaTime);
+			DeviceEntry.Value->UpdateSensorSubscriptions();
+		}
+		TickPolls(DeltaTime);
+
+		if (!HapticsClock)
+		{
+			FlushMessages(DeltaTime);
+		}
+
+		while (NetworkWorker && NetworkWorker->DequeueMessages(IncomingMessages))
+		{
+			DispatchIncomingMessages();
+		}
+
+		TArray<FButtplugMessageFailedFunction> Failed;
+		MessageTracker->ExpireTimeouts(FPlatformTime::Seconds(), GetDefault<UButtplugSettings>()->MessageTimeout, Failed);
+		for (FButtplugMessageFailedFunction& OnFailed : Failed)
+		{
+			OnFailed(TEXT("timed out waiting for reply"));
+		}
+		Failed.Reset();
+		MessageTracker->TakeDropped(Failed);
+		for (FButtplugMessageFailedFunction& OnFailed : Failed)
+		{
+			OnFailed(TEXT("dropped before being sent"));
+		}
+
+		bool bNowCongested = bCongested.load(std::memory_order_relaxed);
+		if (bNowCongested != bReportedCongested)
+		{
+			bReportedCongested = bNowCongested;
+			UE_LOGFMT(LogButtplug, Verbose, "Buttplug server congestion {State}", bNowCongested ? TEXT("started") : TEXT("cleared"));
+			OnCongestionChanged.Broadcast(bNowCongested);
 		}
+	}
+}
+
+void UButtplugSubsystem::FlushMessages(float DeltaTime)
+{
+	FScopeLock Lock(&HapticsLock);
+	const UButtplugSettings* Settings = GetDefault<UButtplugSettings>();
+	int32 NumInFlight = MessageTracker->GetNumInFlight();
+	if (NumInFlight >= Settings->CongestionHighWatermark)
+	{
+		bCongested.store(true, std::memory_order_relaxed);
+	}
+	else if (NumInFlight <= Settings->CongestionHighWatermark / 2)
+	{
+		bCongested.store(false, std::memory_order_relaxed);
+	}
+
+	DrainSubmissions();
+	FeatureStore->ExpireDeadlines(FPlatformTime::Seconds());
+	for (const TPair<int32, TObjectPtr<UButtplugDevice>>& DeviceEntry : Devices)
+	{
+		TObjectPtr<UButtplugDevice> Device = DeviceEntry.Value;
+		Device->FlushMessageQueue(DeltaTime);
+	}
 
-		if (!MessageBuffer.IsEmpty())
+	if (bCongested.load(std::memory_order_relaxed) && Settings->BackpressurePolicy == EButtplugBackpressurePolicy::DropOldest)
+	{
+		// Only actuation and sensor reads wait in the bounded queue; everything else gets through.
+		for (int32 Index = 0; Index < MessageBuffer.Num();)
 		{
-			uint32 FirstId = MessageBuffer[0]->Id;
-			UE_LOGFMT(LogButtplug, Verbose, "Sending messages {Min}..{Max} to Buttplug", FirstId, NextMessageId);
-			FString Json = WriteButtplugMessagesToJson(MessageBuffer);
-			WebSocket->Send(Json);
-			MessageBuffer.Empty();
+			if (!MessageBuffer[Index].IsDroppable())
+			{
+				PriorityBuffer.Add(MoveTemp(MessageBuffer[Index]));
+				MessageBuffer.RemoveAt(Index, 1, /*bAllowShrinking:*/false);
+			}
+			else
+			{
+				++Index;
+			}
 		}
+		SendBatch(PriorityBuffer);
+	}
+	else
+	{
+		SendBatch(MessageBuffer);
+	}
+}
+
+void UButtplugSubsystem::SendBatch(FButtplugMessageArray& Batch)
+{
+	if (Batch.IsEmpty()) return;
+
+	// Ids needn't be contiguous or ascending, as sensor reads are numbered when queued on their device.
+	uint32 FirstId = Batch[0].GetMessage().Id;
+	uint32 LastId = Batch.Last().GetMessage().Id;
+	UE_LOGFMT(LogButtplug, Verbose, "Sending {Count} messages to Buttplug, {First} to {Last}", Batch.Num(), FirstId, LastId);
+	MessageTracker->Track(Batch, FPlatformTime::Seconds());
+	if (NetworkWorker)
+	{
+		NetworkWorker->SendMessages(Batch);
+	}
+	else
+	{
+		check(IsInGameThread());
+		// Both buffers keep their allocation between ticks, so steady state sending doesn't allocate.
+		WriteButtplugMessagesToJson(Batch, SendBuffer);
+		WebSocket->Send(SendBuffer.GetData(), SendBuffer.Num(), /*bIsBinary:*/false);
+		Batch.Reset();
 	}
 }
 
@@ -258,11 +518,113 @@ TStatId UButtplugSubsystem::GetStatId() const
 	RETURN_QUICK_DECLARE_CYCLE_STAT(UButtplugSubsystem, STATGROUP_Tickables);
 }
 
-void UButtplugSubsystem::EnqueueMessage(TUniquePtr<FButtplugMessage> Message)
+uint32 UButtplugSubsystem::EnqueueMessage(FButtplugMessageVariant&& Message, FButtplugMessageFailedFunction&& OnFailed)
+{
+	// Thread safe, so that any thread can submit; moved into MessageBuffer on the send path.
+	// Only a failure callback takes a lock, the message tracker's own, never HapticsLock.
+	uint32 Id = Message.GetMessage().Id = NextMessageId.fetch_add(1, std::memory_order_relaxed);
+	if (OnFailed) SetMessageFailedCallback(Id, MoveTemp(OnFailed));
+	SubmittedMessages.Enqueue(MoveTemp(Message));
+	return Id;
+}
+
+uint32 UButtplugSubsystem::BufferMessage(FButtplugMessageVariant&& Message)
+{
+	MakeRoomForMessage();
+	FButtplugMessage& QueuedMessage = MessageBuffer.Add_GetRef(MoveTemp(Message)).GetMessage();
+	if (QueuedMessage.Id == 0)
+	{
+		// Sensor reads are numbered when queued on their device, to match their replies; see UButtplugFeature::EnqueueReadCmd.
+		QueuedMessage.Id = NextMessageId.fetch_add(1, std::memory_order_relaxed);
+	}
+	return QueuedMessage.Id;
+}
+
+void UButtplugSubsystem::DrainSubmissions()
+{
+	// HapticsLock makes this the queues' single consumer.
+	FSubmittedActuation Actuation;
+	while (SubmittedActuations.Dequeue(Actuation))
+	{
+		int32 Row = Actuation.Feature.Row;
+		if (!FeatureStore->IsValid(Actuation.Feature) || !FeatureStore->IsActuator(Row)) continue;
+		// Later submissions replace earlier ones, as if each had been queued directly.
+		FeatureStore->Queue(Row, FeatureStore->Quantize(Row, Actuation.Value), Actuation.Duration, Actuation.SubmitTime);
+	}
+
+	FButtplugMessageVariant Message;
+	while (SubmittedMessages.Dequeue(Message))
+	{
+		MakeRoomForMessage();
+		MessageBuffer.Add(MoveTemp(Message));
+	}
+}
+
+void UButtplugSubsystem::DiscardSubmissions()
+{
+	FButtplugMessageVariant Message;
+	while (SubmittedMessages.Dequeue(Message))
+	{
+		MessageTracker->Drop(Message.GetMessage().Id);
+	}
+	SubmittedActuations.Empty();
+}
+
+uint32 UButtplugSubsystem::SendPriorityMessage(FButtplugMessageVariant&& Message, FButtplugMessageFailedFunction&& OnFailed)
 {
 	check(IsConnected());
-	Message->Id = NextMessageId++;
-	MessageBuffer.Add(MoveTemp(Message));
+	check(Message.IsStop());
+	// Also serializes this send with the haptics clock's, which the network worker requires.
+	FScopeLock Lock(&HapticsLock);
+	DrainSubmissions();
+
+	TOptional<uint32> StoppedDeviceIndex = Message.GetDeviceIndex();
+	for (int32 Index = 0; Index < MessageBuffer.Num();)
+	{
+		const FButtplugMessageVariant& Queued = MessageBuffer[Index];
+		EButtplugMessageType QueuedType = Queued.GetMessageType();
+		bool bIsActuation = QueuedType == EButtplugMessageType::ScalarCmd || QueuedType == EButtplugMessageType::LinearCmd || QueuedType == EButtplugMessageType::RotateCmd;
+		if (bIsActuation && (!StoppedDeviceIndex.IsSet() || Queued.GetDeviceIndex() == StoppedDeviceIndex))
+		{
+			MessageTracker->Drop(Queued.GetMessage().Id);
+			MessageBuffer.RemoveAt(Index, 1, /*bAllowShrinking:*/false);
+			DroppedMessageCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			++Index;
+		}
+	}
+
+	FButtplugMessage& SentMessage = PriorityBuffer.Add_GetRef(MoveTemp(Message)).GetMessage();
+	uint32 Id = SentMessage.Id = NextMessageId.fetch_add(1, std::memory_order_relaxed);
+	if (OnFailed) SetMessageFailedCallback(Id, MoveTemp(OnFailed));
+	SendBatch(PriorityBuffer);
+	return Id;
+}
+
+void UButtplugSubsystem::SetMessageFailedCallback(uint32 Id, FButtplugMessageFailedFunction&& OnFailed)
+{
+	MessageTracker->SetFailedCallback(Id, MoveTemp(OnFailed));
+}
+
+void UButtplugSubsystem::MakeRoomForMessage()
+{
+	if (MessageBuffer.Num() < GetDefault<UButtplugSettings>()->MaxQueuedMessages) return;
+
+	int32 OldestIndex = MessageBuffer.IndexOfByPredicate([](const FButtplugMessageVariant& Message) { return Message.IsDroppable(); });
+	if (OldestIndex == INDEX_NONE) return;
+
+	uint32 Id = MessageBuffer[OldestIndex].GetMessage().Id;
+	UE_LOGFMT(LogButtplug, Verbose, "Buttplug send queue full; dropping message {Id}", Id);
+	MessageTracker->Drop(Id);
+	MessageBuffer.RemoveAt(OldestIndex, 1, /*bAllowShrinking:*/false);
+	DroppedMessageCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool UButtplugSubsystem::IsHoldingActuation() const
+{
+	return bCongested.load(std::memory_order_relaxed) && GetDefault<UButtplugSettings>()->BackpressurePolicy == EButtplugBackpressurePolicy::CoalesceLatest;
 }
 
 void UButtplugSubsystem::StartPingTimer(float PingRate)
@@ -274,7 +636,7 @@ void UButtplugSubsystem::TickPingTimer()
 {
 	if (WebSocket.IsValid())
 	{
-		EnqueueMessage(MakeUnique<FButtplugMessage::Ping>());
+		EnqueueMessage(FButtplugMessage::Ping());
 	}
 	else
 	{
@@ -286,15 +648,28 @@ void UButtplugSubsystem::Reset(const FString& Reason)
 {
 	GetGameInstance()->GetTimerManager().ClearTimer(PingTimer);
 
+	// Join the clock and worker before closing the socket they send on.
+	HapticsClock.Reset();
+	NetworkWorker.Reset();
+
+	DiscardSubmissions();
+	TArray<FButtplugMessageFailedFunction> Abandoned;
+	MessageTracker->Reset(Abandoned);
+	for (FButtplugMessageFailedFunction& OnFailed : Abandoned)
+	{
+		OnFailed(Reason);
+	}
+
 	for (const TPair<int32, TObjectPtr<UButtplugDevice>>& DeviceEntry : Devices)
 	{
 		DeviceEntry.Value->SetConnected(false);
 	}
+	PublishRegistry();
 
 	if (WebSocket.IsValid())
 	{
 		int32 CloseCode = 1001; // Going away
-		WebSocket->Close(CloseCode, Reason);
+		CloseSocket(CloseCode, Reason);
 		WebSocket = nullptr;
 	}
 
@@ -310,18 +685,158 @@ void UButtplugSubsystem::Reset(const FString& Reason)
 	ServerName.Empty();
 	ServerAddress.Empty();
 	PingTimer.Invalidate();
-	NextMessageId = 1;
+	NextMessageId.store(1, std::memory_order_relaxed);
 	MessageBuffer.Empty();
+	PriorityBuffer.Empty();
+	SendBuffer.Empty();
+	IncomingMessages.Empty();
 	WebSocket = nullptr;
 	LatentStartAction = nullptr;
+	bCongested.store(false, std::memory_order_relaxed);
+	if (bReportedCongested)
+	{
+		bReportedCongested = false;
+		OnCongestionChanged.Broadcast(false);
+	}
 	// Keep the Devices map around, in case we reconnect.
 }
 
+void UButtplugSubsystem::CloseSocket(int32 CloseCode, const FString& Reason)
+{
+	// The worker sends on the socket from its own thread, and the clock sends through the worker.
+	// Once they're joined, anything still sent before OnSocketClosed resets us goes from the game thread.
+	HapticsClock.Reset();
+	NetworkWorker.Reset();
+	WebSocket->Close(CloseCode, Reason);
+}
+
+void UButtplugSubsystem::PublishRegistry()
+{
+	FScopeLock Lock(&HapticsLock);
+	FButtplugRegistrySnapshot Snapshot;
+	Snapshot.Devices.Reserve(Devices.Num());
+	for (const TPair<int32, TObjectPtr<UButtplugDevice>>& DeviceEntry : Devices)
+	{
+		const UButtplugDevice* Device = DeviceEntry.Value;
+		FButtplugDeviceSnapshot& DeviceSnapshot = Snapshot.Devices.AddDefaulted_GetRef();
+		DeviceSnapshot.Handle = Device->GetHandle();
+		DeviceSnapshot.DeviceIndex = Device->DeviceIndex;
+		DeviceSnapshot.DescriptiveName = Device->DescriptiveName;
+		DeviceSnapshot.DisplayName = Device->DisplayName;
+		DeviceSnapshot.bConnected = Device->bConnected;
+		DeviceSnapshot.ActuatorTypeMask = Device->ActuatorsByType.TypeMask;
+		DeviceSnapshot.SensorTypeMask = Device->SensorsByType.TypeMask;
+		DeviceSnapshot.Features.Reserve(Device->Features.Num());
+		for (const UButtplugFeature* Feature : Device->Features)
+		{
+			FButtplugFeatureSnapshot& FeatureSnapshot = DeviceSnapshot.Features.AddDefaulted_GetRef();
+			FeatureSnapshot.Handle = Feature->GetHandle();
+			FeatureSnapshot.FeatureType = Feature->FeatureType;
+			FeatureSnapshot.FeatureDescriptor = Feature->FeatureDescriptor;
+			FeatureSnapshot.bActuator = Feature->IsActuator();
+			FeatureSnapshot.ActuatorStepCount = Feature->ActuatorStepCount;
+			FeatureSnapshot.SensorRange = Feature->SensorRange;
+		}
+	}
+	Registry.Publish(MoveTemp(Snapshot));
+}
+
+void UButtplugSubsystem::AddSensorRoutes(UButtplugDevice* Device)
+{
+	// A reading's sensor index is into either the SensorReadCmd or SensorSubscribeCmd attributes, which needn't agree;
+	// see <https://github.com/buttplugio/buttplug/issues/535>. Both are routed, and the reading's Id picks between them.
+	for (UButtplugFeature* Feature : Device->Features)
+	{
+		if (Feature->CanRead())
+		{
+			SensorRoutes.FindOrAdd({ Device->DeviceIndex, Feature->FeatureType, Feature->GetCmdIndex() }).ReadFeature = Feature;
+		}
+		if (Feature->CanSubscribe())
+		{
+			SensorRoutes.FindOrAdd({ Device->DeviceIndex, Feature->FeatureType, Feature->GetCmdIndex() }).SubscribeFeature = Feature;
+		}
+	}
+}
+
+void UButtplugSubsystem::RemoveSensorRoutes(uint32 DeviceIndex)
+{
+	for (TMap<FSensorRouteKey, FSensorRoute>::TIterator It = SensorRoutes.CreateIterator(); It; ++It)
+	{
+		if (It.Key().DeviceIndex == DeviceIndex)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void UButtplugSubsystem::SchedulePoll(UButtplugFeature* Feature)
+{
+	// Staggered, so that sensors given the same rate at once don't all come due on the same tick.
+	Feature->NextPollTime = FPlatformTime::Seconds() + FMath::FRand() / Feature->PollRate;
+	PolledFeatures.AddUnique(Feature);
+}
+
+void UButtplugSubsystem::TickPolls(float DeltaTime)
+{
+	if (PolledFeatures.IsEmpty()) return;
+
+	// At most a tenth of a second's budget accrues, so polls are spread across ticks rather than sent in bursts.
+	float Budget = GetDefault<UButtplugSettings>()->SensorPollBudget;
+	PollAllowance = FMath::Min(PollAllowance + Budget * DeltaTime, FMath::Max(1.0, Budget * 0.1));
+
+	double Now = FPlatformTime::Seconds();
+	DuePolls.Reset();
+	for (int32 Index = 0; Index < PolledFeatures.Num();)
+	{
+		UButtplugFeature* Feature = PolledFeatures[Index].Get();
+		if (!Feature || Feature->PollRate <= 0)
+		{
+			PolledFeatures.RemoveAtSwap(Index, 1, /*bAllowShrinking:*/false);
+			continue;
+		}
+		++Index;
+
+		// A sensor with a read still in flight is skipped rather than sent a backlog; it's polled again once the reply arrives.
+		if (Feature->NextPollTime <= Now && Feature->PendingReadId == 0 && Feature->GetDevice()->IsConnected())
+		{
+			DuePolls.Add(Feature);
+		}
+	}
+
+	// Most overdue first, so that a tight budget is still shared fairly.
+	DuePolls.Sort([](const UButtplugFeature& A, const UButtplugFeature& B) { return A.NextPollTime < B.NextPollTime; });
+	for (UButtplugFeature* Feature : DuePolls)
+	{
+		if (PollAllowance < 1.0) break;
+		PollAllowance -= 1.0;
+		Feature->NextPollTime = Now + 1.0 / Feature->PollRate;
+		Feature->Read();
+	}
+}
+
 void UButtplugSubsystem::OnSocketConnected()
 {
-	TUniquePtr<FButtplugMessage::RequestServerInfo> Message = MakeUnique<FButtplugMessage::RequestServerInfo>();
-	Message->ClientName = ClientName;
-	Message->MessageVersion = FButtplugMessage::SpecVersion();
+	// Nothing submitted before the handshake may go ahead of it. Done before the clock starts draining.
+	DiscardSubmissions();
+	const UButtplugSettings* Settings = GetDefault<UButtplugSettings>();
+	// The clock sends from its own thread, so it needs the worker to keep the socket off every thread but one.
+	if ((Settings->bUseNetworkThread || Settings->bUseHapticsClock) && FPlatformProcess::SupportsMultithreading())
+	{
+		NetworkWorker = MakeUnique<FButtplugNetworkWorker>(WebSocket.ToSharedRef(), *MessageTracker);
+	}
+	if (Settings->bUseHapticsClock && NetworkWorker)
+	{
+		// The clock only runs while connected, and is joined in Reset before this subsystem or the socket can go away.
+		// It doesn't ask the socket whether it's connected, as IWebSocket isn't safe to use from the clock thread.
+		HapticsClock = MakeUnique<FButtplugHapticsClock>(Settings->HapticsClockRate, [this](float DeltaTime)
+		{
+			FlushMessages(DeltaTime);
+		});
+	}
+
+	FButtplugMessage::RequestServerInfo Message;
+	Message.ClientName = ClientName;
+	Message.MessageVersion = FButtplugMessage::SpecVersion();
 	EnqueueMessage(MoveTemp(Message));
 	// TODO: add timeout for initial handshake
 }
@@ -341,8 +856,8 @@ template<EButtplugMessageType MessageType>
 void UButtplugSubsystem::OnServerMessage(const TButtplugMessage<MessageType>& Message)
 {
 	int32 CloseCode = 1008; // Policy violation
-	WebSocket->Close(CloseCode, TEXT("server sent a client-to-server message unexpectedly"));
-	UE_LOGFMT(LogButtplug, Warning, "Buttplug server sent client message {Message}", Buttplug::Private::GetEnumAsString(Message.GetMessageType()));
+	CloseSocket(CloseCode, TEXT("server sent a client-to-server message unexpectedly"));
+	UE_LOGFMT(LogButtplug, Warning, "Buttplug server sent client message {Message}", Buttplug::Private::GetEnumAsString(MessageType));
 }
 
 template<>
@@ -355,7 +870,7 @@ template<>
 void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::Error>(const FButtplugMessage::Error& Message)
 {
 	uint8 ErrorCode = static_cast<uint8>(Message.Code);
-	UE_LOGFMT(LogButtplug, Warning, "Buttplug server reported error {Code}; {Message}", ErrorCode, Message.Message);
+	UE_LOGFMT(LogButtplug, Warning, "Buttplug server reported error {Code} for message {Id}; {Message}", ErrorCode, Message.Id, Message.Message);
 }
 
 template<>
@@ -373,7 +888,7 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::ServerInfo>(const
 		}
 
 		UE_LOGFMT(LogButtplug, Verbose, "Connected to Buttplug server {Server} at {Addresss}", ServerName, ServerAddress);
-		EnqueueMessage(MakeUnique<FButtplugMessage::RequestDeviceList>());
+		EnqueueMessage(FButtplugMessage::RequestDeviceList());
 		// Convert milliseconds to seconds and ping twice as often as required to avoid timeout
 		StartPingTimer(Message.MaxPingTime / 2000.0);
 		OnConnected.Broadcast();
@@ -381,7 +896,7 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::ServerInfo>(const
 	else
 	{
 		int32 CloseCode = 1008; // Policy violation
-		WebSocket->Close(CloseCode, TEXT("server responded with incompatible protocol version"));
+		CloseSocket(CloseCode, TEXT("server responded with incompatible protocol version"));
 	}
 }
 
@@ -400,12 +915,12 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceList>(const
 	// We only ask for a device list on initial connection, and otherwise maintain our own list.
 	// Thus a DeviceList message serves to indicate devices present when connecting; add them.
 	if (Message.Devices.IsEmpty()) return;
-	TUniquePtr<FButtplugMessage::DeviceAdded> SyntheticMessage = MakeUnique<FButtplugMessage::DeviceAdded>();
-	SyntheticMessage->Id = Message.Id;
+	FButtplugMessage::DeviceAdded SyntheticMessage;
+	SyntheticMessage.Id = Message.Id;
 	for (const FButtplugMessage::Device& Device : Message.Devices)
 	{
-		SyntheticMessage->Device = Device;
-		OnServerMessage(*SyntheticMessage);
+		SyntheticMessage.Device = Device;
+		OnServerMessage(SyntheticMessage);
 	}
 }
 
@@ -421,33 +936,38 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceAdded>(cons
 			// Intiface® Central (the first party server application) has stable indices, even between sessions.
 			// Hitting this case for a device with a nonequal set of accepted device messages is very unlikely.
 			Device->SetConnected(true);
+			PublishRegistry();
 			OnDeviceAdded.Broadcast(Device);
 			return;
 		}
 		else
 		{
 			// Device index was reused for a different device. Fallthrough to constructing the new one.
-			Device = nullptr;
+			RemoveSensorRoutes(Message.Device.Index);
 		}
 	}
 
-	Device = Devices.Add(Message.Device.Index, NewObject<UButtplugDevice>(this));
+	TObjectPtr<UButtplugDevice> ReplacedDevice = Device;
+	Device = NewObject<UButtplugDevice>(this);
 	Device->DeviceIndex = Message.Device.Index;
 	Device->DescriptiveName = Message.Device.Name;
 	Device->DisplayName = Message.Device.DisplayName;
 	Device->DefaultMessageTimingGap = Message.Device.MessageTimingGap / 1000.0; // convert units: (uint)ms to (float)s
+	Device->UpdateSendIntervalLimits();
 	
 	// TODO: try to unify features between commands? That's O(n^2) for spec v3 (though feature count is low).
 	// I don't think Intiface exposes a device where one feature can be in multiple command arrays yet.
 
+	// Which command each feature is listed under, for the feature store; the features themselves don't keep it.
+	TArray<UButtplugDevice::FFeatureCmd, TInlineAllocator<16>> FeatureCmds;
 	int32 Index = 0;
 	for (const FButtplugMessage::DeviceMessageAttributes& ScalarCmd : Message.Device.Messages.ScalarCmd)
 	{
 		TObjectPtr<UButtplugFeature> Feature = Device->Features.Add_GetRef(NewObject<UButtplugFeature>(Device));
-		Feature->ScalarCmdIndex = Index;
+		FeatureCmds.Add({ EButtplugMessageType::ScalarCmd, uint32(Index) });
 		Feature->FeatureDescriptor = ScalarCmd.FeatureDescriptor;
 		Feature->ActuatorStepCount = ScalarCmd.StepCount;
-		Feature->FeatureType = Buttplug::Private::GetEnumByName<EButtplugFeatureType>(ScalarCmd.ActuatorType);
+		Buttplug::Private::FindEnumByName(ScalarCmd.ActuatorType, Feature->FeatureType);
 		++Index;
 	}
 
@@ -455,10 +975,10 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceAdded>(cons
 	for (const FButtplugMessage::DeviceMessageAttributes& LinearCmd : Message.Device.Messages.LinearCmd)
 	{
 		TObjectPtr<UButtplugFeature> Feature = Device->Features.Add_GetRef(NewObject<UButtplugFeature>(Device));
-		Feature->LinearCmdIndex = Index;
+		FeatureCmds.Add({ EButtplugMessageType::LinearCmd, uint32(Index) });
 		Feature->FeatureDescriptor = LinearCmd.FeatureDescriptor;
 		Feature->ActuatorStepCount = LinearCmd.StepCount;
-		Feature->FeatureType = Buttplug::Private::GetEnumByName<EButtplugFeatureType>(LinearCmd.ActuatorType);
+		Buttplug::Private::FindEnumByName(LinearCmd.ActuatorType, Feature->FeatureType);
 		++Index;
 	}
 
@@ -466,10 +986,10 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceAdded>(cons
 	for (const FButtplugMessage::DeviceMessageAttributes& RotateCmd : Message.Device.Messages.RotateCmd)
 	{
 		TObjectPtr<UButtplugFeature> Feature = Device->Features.Add_GetRef(NewObject<UButtplugFeature>(Device));
-		Feature->RotateCmdIndex = Index;
+		FeatureCmds.Add({ EButtplugMessageType::RotateCmd, uint32(Index) });
 		Feature->FeatureDescriptor = RotateCmd.FeatureDescriptor;
 		Feature->ActuatorStepCount = RotateCmd.StepCount;
-		Feature->FeatureType = Buttplug::Private::GetEnumByName<EButtplugFeatureType>(RotateCmd.ActuatorType);
+		Buttplug::Private::FindEnumByName(RotateCmd.ActuatorType, Feature->FeatureType);
 		++Index;
 	}
 
@@ -477,10 +997,10 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceAdded>(cons
 	for (const FButtplugMessage::DeviceMessageAttributes& SensorReadCmd : Message.Device.Messages.SensorReadCmd)
 	{
 		TObjectPtr<UButtplugFeature> Feature = Device->Features.Add_GetRef(NewObject<UButtplugFeature>(Device));
-		Feature->SensorReadCmdIndex = Index;
+		FeatureCmds.Add({ EButtplugMessageType::SensorReadCmd, uint32(Index) });
 		Feature->FeatureDescriptor = SensorReadCmd.FeatureDescriptor;
 		Feature->SensorRange = SensorReadCmd.SensorRange;
-		Feature->FeatureType = Buttplug::Private::GetEnumByName<EButtplugFeatureType>(SensorReadCmd.SensorType);
+		Buttplug::Private::FindEnumByName(SensorReadCmd.SensorType, Feature->FeatureType);
 		++Index;
 	}
 
@@ -488,14 +1008,38 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceAdded>(cons
 	for (const FButtplugMessage::DeviceMessageAttributes& SensorSubscribeCmd : Message.Device.Messages.SensorSubscribeCmd)
 	{
 		TObjectPtr<UButtplugFeature> Feature = Device->Features.Add_GetRef(NewObject<UButtplugFeature>(Device));
-		Feature->SensorSubscribeCmdIndex = Index;
+		FeatureCmds.Add({ EButtplugMessageType::SensorSubscribeCmd, uint32(Index) });
 		Feature->FeatureDescriptor = SensorSubscribeCmd.FeatureDescriptor;
 		Feature->SensorRange = SensorSubscribeCmd.SensorRange;
-		Feature->FeatureType = Buttplug::Private::GetEnumByName<EButtplugFeatureType>(SensorSubscribeCmd.SensorType);
+		Buttplug::Private::FindEnumByName(SensorSubscribeCmd.SensorType, Feature->FeatureType);
 		++Index;
 	}
 
+	{
+		// The haptics clock flushes devices from its own thread, so it only sees the device once it's fully built.
+		FScopeLock Lock(&HapticsLock);
+		if (ReplacedDevice)
+		{
+			ReplacedDevice->RemoveFromFeatureStore();
+		}
+		// The feature index asks the store which features are actuators and sensors, so is built once they have rows.
+		Device->AddToFeatureStore(FeatureCmds);
+		Device->BuildFeatureIndex();
+		Devices.Add(Message.Device.Index, Device);
+	}
+	AddSensorRoutes(Device);
+
+	float BatteryPollInterval = GetDefault<UButtplugSettings>()->BatteryPollInterval;
+	if (BatteryPollInterval > 0)
+	{
+		for (int32 FeatureIndex : Device->SensorsByType.Get(EButtplugFeatureType::Battery))
+		{
+			Device->Features[FeatureIndex]->SetPollRate(1.0f / BatteryPollInterval);
+		}
+	}
+
 	Device->SetConnected(true);
+	PublishRegistry();
 	OnDeviceAdded.Broadcast(Device);
 }
 
@@ -508,50 +1052,83 @@ void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::DeviceRemoved>(co
 		return;
 	}
 
+	// Like DeviceAdded, only the feature store update takes HapticsLock (within SetConnected), not the broadcasts.
 	TObjectPtr<UButtplugDevice> Device = Devices[Message.DeviceIndex];
 	Device->SetConnected(false);
+	PublishRegistry();
 	OnDeviceRemoved.Broadcast(Device);
 }
 
 template<>
 void UButtplugSubsystem::OnServerMessage<EButtplugMessageType::SensorReading>(const FButtplugMessage::SensorReading& Message)
 {
-	if (!Devices.Contains(Message.DeviceIndex))
+	const FSensorRoute* Route = SensorRoutes.Find({ Message.DeviceIndex, Message.SensorType, Message.SensorIndex });
+	if (!Route)
 	{
-		UE_LOGFMT(LogButtplug, Warning, "Buttplug server reported sensor reading for device {Index} but we never saw that device added", Message.DeviceIndex);
+		if (!Devices.Contains(Message.DeviceIndex))
+		{
+			UE_LOGFMT(LogButtplug, Warning, "Buttplug server reported sensor reading for device {Index} but we never saw that device added", Message.DeviceIndex);
+			return;
+		}
+		UE_LOGFMT(LogButtplug, Warning, "Buttplug server reported sensor reading for device {Device}'s {Feature} sensor {Sensor} but we don't know about that sensor", Message.DeviceIndex, Buttplug::Private::GetEnumAsString(Message.SensorType), Message.SensorIndex);
 		return;
 	}
 
-	bool bDidBroadcastReading = false;
-	TObjectPtr<UButtplugDevice> Device = Devices[Message.DeviceIndex];
-	EButtplugFeatureType FeatureType = Buttplug::Private::GetEnumByName<EButtplugFeatureType>(Message.SensorType);
-
-	for (TObjectPtr<UButtplugFeature> Feature : Device->Features)
+	if (Message.Id == 0)
 	{
-		if ((Feature->FeatureType == FeatureType) &&
-			(Feature->SensorReadCmdIndex == Message.SensorIndex || Feature->SensorSubscribeCmdIndex == Message.SensorIndex))
+		// Subscribed readings are unsolicited, so carry no Id.
+		if (Route->SubscribeFeature) Route->SubscribeFeature->SetSensorReading(Message.Data);
+	}
+	else if (UButtplugFeature* Feature = Route->ReadFeature)
+	{
+		// The reply to a SensorReadCmd. Reads sent through the native handle API have no pending read to complete.
+		if (Feature->PendingReadId == Message.Id)
+		{
+			Feature->CompleteRead(Message.Data);
+		}
+		else
 		{
-			if (bDidBroadcastReading)
-			{
-				UE_LOGFMT(LogButtplug, Warning, "Buttplug protocol encountered ambiguous sensor for device {Index}; see <https://github.com/buttplugio/buttplug/issues/535>", Message.DeviceIndex);
-			}
 			Feature->SetSensorReading(Message.Data);
-			bDidBroadcastReading = true;
 		}
 	}
+}
 
-	if (!bDidBroadcastReading)
+void UButtplugSubsystem::OnSocketMessage(const FString& MessageString)
+{
+	if (NetworkWorker)
 	{
-		UE_LOGFMT(LogButtplug, Warning, "Buttplug server reported sensor reading for device {Device}'s {Feature} sensor {Sensor} but we don't know about that sensor", Message.DeviceIndex, Message.SensorType, Message.SensorIndex);
+		// Decoded on the worker and dispatched next tick.
+		NetworkWorker->ReceiveFrame(MessageString);
+		return;
 	}
+
+	ReadButtplugMessagesFromJson(MessageString, IncomingMessages);
+	DispatchIncomingMessages();
 }
 
-void UButtplugSubsystem::OnSocketMessage(const FString& MessageString)
+void UButtplugSubsystem::DispatchIncomingMessages()
 {
-	FButtplugMessageArray MessageArray;
-	ReadButtplugMessagesFromJson(MessageString, MessageArray);
-	for (TUniquePtr<FButtplugMessage>& Message : MessageArray)
+	// Handlers run game code, which may reset the connection and with it IncomingMessages, so dispatch from a local.
+	FButtplugMessageArray Messages = MoveTemp(IncomingMessages);
+	TSharedPtr<IWebSocket> Socket = WebSocket;
+	double ReceiveTime = FPlatformTime::Seconds();
+	for (const FButtplugMessageVariant& Message : Messages)
+	{
+		// The rest of the frame belongs to a connection a handler has closed.
+		if (WebSocket != Socket) break;
+
+		const FButtplugMessage::Error* Error = Message.TryGet<FButtplugMessage::Error>();
+		if (FButtplugMessageFailedFunction OnFailed = MessageTracker->Complete(Message.GetMessage().Id, ReceiveTime, Error != nullptr))
+		{
+			OnFailed(Error->Message);
+		}
+		Message.Visit([this](const auto& TypedMessage) { OnServerMessage(TypedMessage); });
+	}
+
+	// Hand the allocation back for the next frame.
+	Messages.Reset();
+	if (IncomingMessages.IsEmpty())
 	{
-		Message->Dispatch([this](auto Message) { OnServerMessage(Message); });
+		Swap(IncomingMessages, Messages);
 	}
 }
@@ -0,0 +1,84 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#include "ButtplugTimingWheel.h"
+
+static_assert(FMath::IsPowerOfTwo(FButtplugTimingWheel::NumSlots), "Timing wheel slot count must be a power of two");
+
+void FButtplugTimingWheel::Schedule(int32 Key, double Deadline, double Now)
+{
+	check(Key >= 0);
+	Cancel(Key);
+	if (NumScheduled == 0)
+	{
+		// Nothing is waiting, so there is no need to walk the slots passed while the wheel was idle.
+		CurrentTick = GetTick(Now);
+	}
+
+	// Deadlines already passed go in the current slot, so that the next Advance still visits them.
+	int32 Slot = static_cast<int32>(FMath::Max(GetTick(Deadline), CurrentTick) & (NumSlots - 1));
+	if (Locations.Num() <= Key)
+	{
+		Locations.SetNum(Key + 1);
+	}
+	Locations[Key] = { Slot, Slots[Slot].Num() };
+	Slots[Slot].Add({ Key, Deadline });
+	++NumScheduled;
+}
+
+void FButtplugTimingWheel::Cancel(int32 Key)
+{
+	if (!Locations.IsValidIndex(Key) || Locations[Key].Slot == INDEX_NONE) return;
+	RemoveAt(Locations[Key].Slot, Locations[Key].Position);
+}
+
+void FButtplugTimingWheel::Reset()
+{
+	for (TArray<FEntry>& Slot : Slots)
+	{
+		Slot.Reset();
+	}
+	for (FLocation& Location : Locations)
+	{
+		Location = {};
+	}
+	NumScheduled = 0;
+}
+
+void FButtplugTimingWheel::Advance(double Now, TArray<int32>& OutExpired)
+{
+	if (NumScheduled == 0) return;
+
+	int64 NowTick = GetTick(Now);
+	// After a full turn every slot has been passed; don't visit any twice.
+	int64 LastTick = FMath::Min(NowTick, CurrentTick + NumSlots - 1);
+	for (int64 Tick = CurrentTick; Tick <= LastTick; ++Tick)
+	{
+		int32 Slot = static_cast<int32>(Tick & (NumSlots - 1));
+		for (int32 Position = 0; Position < Slots[Slot].Num();)
+		{
+			const FEntry& Entry = Slots[Slot][Position];
+			if (Entry.Deadline <= Now)
+			{
+				OutExpired.Add(Entry.Key);
+				RemoveAt(Slot, Position);
+			}
+			else
+			{
+				++Position;
+			}
+		}
+	}
+	CurrentTick = FMath::Max(CurrentTick, NowTick);
+}
+
+void FButtplugTimingWheel::RemoveAt(int32 Slot, int32 Position)
+{
+	TArray<FEntry>& Entries = Slots[Slot];
+	Locations[Entries[Position].Key] = {};
+	Entries.RemoveAtSwap(Position, 1, /*bAllowShrinking:*/false);
+	if (Position < Entries.Num())
+	{
+		Locations[Entries[Position].Key].Position = Position;
+	}
+	--NumScheduled;
+}
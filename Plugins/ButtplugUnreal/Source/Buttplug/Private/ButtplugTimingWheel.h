@@ -0,0 +1,52 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+/// Hashed timing wheel of deadlines, at most one per key.
+/// Scheduling and cancelling are O(1); advancing only visits the slots that time has passed through.
+/// Not thread safe; FButtplugFeatureStore keys its wheel by store row, and UButtplugSubsystem's HapticsLock guards the store.
+class FButtplugTimingWheel
+{
+public:
+	/// Width of each slot. Deadlines are still compared exactly; this only decides which slot they wait in.
+	static constexpr double SlotDuration = 0.005;
+	/// Must be a power of two. Deadlines further out than one turn of the wheel are skipped over until due.
+	static constexpr int32 NumSlots = 256;
+
+	/// Set the deadline for a key, replacing any it already had.
+	/// @param Now The current time, on the same clock as Deadline.
+	void Schedule(int32 Key, double Deadline, double Now);
+	/// Remove the deadline for a key, if it has one.
+	void Cancel(int32 Key);
+	/// Remove all deadlines.
+	void Reset();
+	/// Remove every deadline at or before Now, collecting their keys.
+	void Advance(double Now, TArray<int32>& OutExpired);
+
+	bool IsEmpty() const { return NumScheduled == 0; }
+
+private:
+	struct FEntry
+	{
+		int32 Key = INDEX_NONE;
+		double Deadline = 0.0;
+	};
+	/// Where a key's entry is, so that it can be removed without searching.
+	struct FLocation
+	{
+		int32 Slot = INDEX_NONE;
+		int32 Position = INDEX_NONE;
+	};
+
+	static int64 GetTick(double Time) { return FMath::FloorToInt64(Time / SlotDuration); }
+	void RemoveAt(int32 Slot, int32 Position);
+
+	TArray<FEntry> Slots[NumSlots];
+	TArray<FLocation> Locations;
+	/// The tick of the last Advance; its slot may still hold deadlines later in the same tick.
+	int64 CurrentTick = 0;
+	int32 NumScheduled = 0;
+};
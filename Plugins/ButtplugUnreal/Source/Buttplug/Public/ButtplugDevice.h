@@ -5,8 +5,37 @@
 #include "CoreMinimal.h"
 #include "ButtplugMinimal.h"
 
+#include "ButtplugHandle.h"
+
 #include "ButtplugDevice.generated.h"
 
+/// Round trip latency of messages sent to the Buttplug server, from sending to receiving the reply.
+USTRUCT(BlueprintType)
+struct FButtplugLatencyStats
+{
+	GENERATED_BODY()
+
+	/// Number of replies received.
+	UPROPERTY(BlueprintReadOnly)
+	int32 Count = 0;
+	/// Number of replies which were errors.
+	UPROPERTY(BlueprintReadOnly)
+	int32 ErrorCount = 0;
+	/// Number of messages which never got a reply.
+	UPROPERTY(BlueprintReadOnly)
+	int32 TimeoutCount = 0;
+	UPROPERTY(BlueprintReadOnly, meta=(Units="ms"))
+	float Mean = 0.0f;
+	/// Approximate; the upper bound of the histogram bucket.
+	UPROPERTY(BlueprintReadOnly, meta=(Units="ms"))
+	float Median = 0.0f;
+	/// Approximate; the upper bound of the histogram bucket.
+	UPROPERTY(BlueprintReadOnly, meta=(Units="ms"))
+	float P99 = 0.0f;
+	UPROPERTY(BlueprintReadOnly, meta=(Units="ms"))
+	float Max = 0.0f;
+};
+
 UCLASS(BlueprintType)
 class BUTTPLUG_API UButtplugDevice : public UObject
 {
@@ -15,6 +44,35 @@ class BUTTPLUG_API UButtplugDevice : public UObject
 	friend class UButtplugFeature;
 	friend class UButtplugSubsystem;
 
+private:
+	/// Indices into Features, grouped by feature type.
+	struct FFeatureTypeIndex
+	{
+		/// Bit N is set if there is a feature of type N.
+		uint32 TypeMask = 0;
+		/// The features of type N are FeatureIndices[Offsets[N]] up to FeatureIndices[Offsets[N + 1]].
+		TArray<int32> FeatureIndices;
+		TArray<int32> Offsets;
+
+		bool Contains(EButtplugFeatureType Type) const { return (TypeMask >> static_cast<int32>(Type)) & 1; }
+		TArrayView<const int32> Get(EButtplugFeatureType Type) const;
+		/// Group the features passing Filter by type, keeping their order within each type.
+		void Build(const TArray<TObjectPtr<UButtplugFeature>>& Features, TFunctionRef<bool(const UButtplugFeature&)> Filter);
+	};
+
+	/// The command a feature is listed under in the device message attributes, and its index there.
+	struct FFeatureCmd
+	{
+		EButtplugMessageType CmdType;
+		uint32 CmdIndex;
+	};
+
+public:
+	// Defined out of line, where the message types held in our queue are complete.
+	UButtplugDevice();
+	UButtplugDevice(FVTableHelper& Helper);
+	virtual ~UButtplugDevice();
+
 public:
 	/// Descriptive name of the device, as taken from the base device configuration file.
 	UFUNCTION(BlueprintGetter)
@@ -31,16 +89,26 @@ public:
 public:
 	/// Actuators of this device.
 	UFUNCTION(BlueprintCallable)
-	void GetActuators(EButtplugFeatureType ActuatorType, TArray<UButtplugFeature*> Actuators) const;
+	void GetActuators(EButtplugFeatureType ActuatorType, TArray<UButtplugFeature*>& Actuators) const;
 	/// Sensors of this device.
 	UFUNCTION(BlueprintCallable)
-	void GetSensors(EButtplugFeatureType SensorType, TArray<UButtplugFeature*> Sensors) const;
+	void GetSensors(EButtplugFeatureType SensorType, TArray<UButtplugFeature*>& Sensors) const;
 	/// The delay imposed between sending messages to this device.
 	UFUNCTION(BlueprintCallable, meta=(Units="s"))
 	float GetMessageTimingGap() const;
 	UFUNCTION(BlueprintCallable, meta=(Units="s"))
 	/// Manually set the gap between sending messages to this device. A negative value restores the default.
 	void SetMessageTimingGap(float Override);
+	/// The interval currently used between sending messages to this device.
+	/// At least the timing gap, and longer if adaptive send rate control has backed off because the server is replying slowly.
+	UFUNCTION(BlueprintCallable, meta=(Units="s"))
+	float GetEffectiveMessageInterval() const;
+	/// How many messages per second this device is currently being sent, at most.
+	UFUNCTION(BlueprintCallable)
+	float GetEffectiveSendRate() const;
+	/// Round trip latency of messages sent to this device.
+	UFUNCTION(BlueprintCallable)
+	FButtplugLatencyStats GetLatencyStats() const;
 
 public:
 	UDELEGATE()
@@ -121,6 +189,7 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void StopAll(EButtplugFeatureType ActuatorType);
 	/// Stop all actuation of this device.
+	/// Sent immediately from the calling thread, ahead of any queued messages and regardless of the timing gap.
 	UFUNCTION(BlueprintCallable)
 	void Stop();
 
@@ -128,6 +197,8 @@ public:
 	/// Does this device report a battery level?
 	UFUNCTION(BlueprintCallable)
 	bool HasBatteryLevel() const;
+	/// The most recently received battery level, from 0 to 1, or -1 if there is none yet.
+	/// Doesn't send anything; the level is polled every UButtplugSettings::BatteryPollInterval.
 	UFUNCTION(BlueprintCallable)
 	float GetBatteryLevel() const;
 
@@ -136,10 +207,24 @@ public:
 
 public:
 	UButtplugSubsystem* GetSubsystem() const;
+	/// Handle to this device for the subsystem's native handle API.
+	FButtplugDeviceHandle GetHandle() const { return Handle; }
 
 private:
 	void SetConnected(bool bInConnected = true);
+	/// Build the lookup tables over Features. Called once the features have store rows, which say what each one is.
+	void BuildFeatureIndex();
+	void UpdateSendIntervalLimits();
+	/// Give this device a slot, and each feature a row, in the subsystem's feature store. Called once the device's features are known.
+	void AddToFeatureStore(TArrayView<const FFeatureCmd> FeatureCmds);
+	/// Give up this device's slot and rows, because the server replaced it. They may go to another device, so they're forgotten here.
+	void RemoveFromFeatureStore();
+	class FButtplugFeatureStore& GetFeatureStore() const;
+	/// Forget queued actuation and record every actuator as stopped, because a stop command is being sent.
+	void CancelQueuedActuation();
 	void FlushMessageQueue(float DeltaTime);
+	/// Follow changes to which sensor features are listened to. Called each tick while connected.
+	void UpdateSensorSubscriptions();
 
 private:
 	/// Descriptive name of the device, as taken from the base device configuration file.
@@ -156,11 +241,19 @@ private:
 	uint32 DeviceIndex = INDEX_NONE;
 
 	bool bConnected = false;
-	bool bHasQueuedStopDevice = false;
+	/// Messages waiting for the timing gap.
 	FButtplugMessageArray MessageQueue;
 	float TimeSinceLastMessage = 0.0f;
+	/// This device's slot in the subsystem's feature store.
+	int32 StoreSlot = INDEX_NONE;
+	/// Handle to StoreSlot, cached when the slot is assigned so that getting it doesn't take HapticsLock.
+	FButtplugDeviceHandle Handle;
 
 	/// Features of this device.
 	UPROPERTY(BlueprintReadOnly, meta=(AllowPrivateAccess=true))
 	TArray<TObjectPtr<UButtplugFeature>> Features;
+
+	/// Built with the features, so that capability queries and fan-out actuation don't visit every feature.
+	FFeatureTypeIndex ActuatorsByType;
+	FFeatureTypeIndex SensorsByType;
 };
@@ -5,6 +5,9 @@
 #include "CoreMinimal.h"
 #include "ButtplugMinimal.h"
 
+#include "ButtplugHandle.h"
+#include "ButtplugSensorHistory.h"
+
 #include "ButtplugFeature.generated.h"
 
 UENUM(BlueprintType)
@@ -33,6 +36,34 @@ enum class EButtplugFeatureType : uint8
 	Pressure,
 };
 
+UENUM()
+enum class EButtplugSensorReadResult : uint8
+{
+	/// The sensor replied with a reading.
+	Succeeded,
+	/// The read was refused, timed out, or lost to a disconnect.
+	Failed,
+};
+
+/// Per-actuator calibration, applied to actuation values before they are sent.
+USTRUCT(BlueprintType)
+struct FButtplugResponseCurve
+{
+	GENERATED_BODY()
+
+	/// Exponent applied to the actuation value. Above 1 gives finer control at low values.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta=(ClampMin=0.01))
+	float Gamma = 1.0f;
+	/// Output for the smallest nonzero actuation, e.g. the lowest strength the device can be felt at.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta=(ClampMin=0, ClampMax=1))
+	float MinThreshold = 0.0f;
+	/// Output for full actuation.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta=(ClampMin=0, ClampMax=1))
+	float MaxCap = 1.0f;
+
+	bool IsIdentity() const { return Gamma == 1.0f && MinThreshold == 0.0f && MaxCap == 1.0f; }
+};
+
 UCLASS(BlueprintType)
 class BUTTPLUG_API UButtplugFeature : public UObject
 {
@@ -40,11 +71,6 @@ class BUTTPLUG_API UButtplugFeature : public UObject
 
 private:
 	class FLatentSensorAction;
-	struct FQueuedActuation
-	{
-		double Value = 0.0;
-		float Duration = 0.0;
-	};
 
 	friend class UButtplugDevice;
 	friend class UButtplugSubsystem;
@@ -80,6 +106,19 @@ public:
 	/// The range and dimensionality of values this sensor can return.
 	UFUNCTION(BlueprintGetter)
 	const TArray<FInt32Interval>& GetSensorRange() const;
+	/// The calibration applied to this actuator's values.
+	UFUNCTION(BlueprintGetter)
+	const FButtplugResponseCurve& GetResponseCurve() const;
+	/// Set the calibration applied to this actuator's values. Precomputed, so it costs nothing per actuation.
+	UFUNCTION(BlueprintSetter)
+	void SetResponseCurve(const FButtplugResponseCurve& Curve);
+	/// How many times per second this sensor is polled.
+	UFUNCTION(BlueprintGetter)
+	float GetPollRate() const;
+	/// Poll this sensor periodically, within the subsystem's sensor poll budget. 0 to only read when asked.
+	/// Readings arrive through OnSensorReading, and are kept in the sensor history.
+	UFUNCTION(BlueprintSetter)
+	void SetPollRate(float Rate);
 
 public:
 	/// Actuate this feature, if possible.
@@ -90,27 +129,57 @@ public:
 	/// Stop actuation of this feature.
 	UFUNCTION(BlueprintCallable)
 	void Stop();
-	/// Subscribe to this sensor, if possible.
+	/// Subscribe to this sensor, if possible. Balance each call with Unsubscribe.
+	/// The server is only subscribed while any subscription remains, and is resubscribed after reconnecting.
+	/// Binding OnSensorReading subscribes too, for as long as it stays bound.
 	UFUNCTION(BlueprintCallable)
 	void Subscribe();
-	/// Unsubscribe from this sensor.
+	/// Release a subscription taken with Subscribe.
 	UFUNCTION(BlueprintCallable)
 	void Unsubscribe();
 	/// Get the most recently received reading from this sensor.
 	UFUNCTION(BlueprintCallable)
 	const TArray<int32>& GetLastSensorReading() const;
-	/// Poll a reading from this sensor, if possible.
-	UFUNCTION(BlueprintCallable, meta=(Latent, LatentInfo="LatentInfo"))
-	void AsyncRead(FLatentActionInfo LatentInfo, TArray<int32>& Reading);
-	/// Poll a reading from this sensor, if possible.
+	/// Recent readings from this sensor, for native code that wants their values without copying them.
+	const FButtplugSensorHistory& GetSensorHistory() const { return SensorHistory; }
+	/// Mean of one of this sensor's values over its recent readings.
+	UFUNCTION(BlueprintCallable)
+	double GetSensorAverage(int32 Channel = 0) const;
+	/// Least of one of this sensor's values over its recent readings.
+	UFUNCTION(BlueprintCallable)
+	int32 GetSensorMin(int32 Channel = 0) const;
+	/// Greatest of one of this sensor's values over its recent readings.
+	UFUNCTION(BlueprintCallable)
+	int32 GetSensorMax(int32 Channel = 0) const;
+	/// Change per second of one of this sensor's values over its recent readings.
+	UFUNCTION(BlueprintCallable)
+	double GetSensorRateOfChange(int32 Channel = 0) const;
+	/// Poll a reading from this sensor, if possible, waiting for the reply to that read.
+	/// Reads started while one is in flight share its reply.
+	/// @param ErrorMessage Why the read failed, if it did.
+	UFUNCTION(BlueprintCallable, meta=(Latent, LatentInfo="LatentInfo", ExpandEnumAsExecs="Result"))
+	void AsyncRead(FLatentActionInfo LatentInfo, EButtplugSensorReadResult& Result, TArray<int32>& Reading, FString& ErrorMessage);
+	/// Poll a reading from this sensor, if possible. The reading arrives through OnSensorReading.
+	/// Does nothing while a read is already in flight.
 	UFUNCTION(BlueprintCallable)
 	void Read();
 
 private:
-	void EnqueueReadCmd() const;
+	/// @return The Id of the read, which its reply will carry.
+	uint32 EnqueueReadCmd();
 	void EnqueueSubscribeCmd() const;
 	void EnqueueUnsubscribeCmd() const;
-	void SetSensorReading(const TArray<int32>& Reading);
+	/// Subscribe or unsubscribe the server, if whether anything wants this sensor's readings has changed.
+	void UpdateSubscription();
+	void SetSensorReading(TArrayView<const int32> Reading);
+	/// Record the reply to the read in flight, and resume everything waiting on it.
+	void CompleteRead(TArrayView<const int32> Reading);
+	/// Fail the read in flight, resuming everything waiting on it.
+	void FailRead(const FString& Reason);
+	/// The number of steps in this actuator's grid; its step count if known.
+	int32 GetStepGrid() const;
+	/// ResponseCurve sampled at each input step, giving the output step. Empty for the identity curve.
+	TArray<uint16> MakeResponseTable() const;
 
 public:
 	UDELEGATE()
@@ -124,6 +193,8 @@ public:
 	/// The device this is a feature of.
 	UFUNCTION(BlueprintCallable)
 	UButtplugDevice* GetDevice() const;
+	/// Handle to this feature for the subsystem's native handle API.
+	FButtplugFeatureHandle GetHandle() const { return Handle; }
 
 private:
 	/// Description of the feature.
@@ -139,17 +210,36 @@ private:
 	/// The range of values this sensor can return.
 	UPROPERTY(BlueprintGetter=GetSensorRange)
 	TArray<FInt32Interval> SensorRange;
+	/// The calibration applied to this actuator's values.
+	UPROPERTY(BlueprintGetter=GetResponseCurve, BlueprintSetter=SetResponseCurve)
+	FButtplugResponseCurve ResponseCurve;
+	/// How many times per second this sensor is polled.
+	UPROPERTY(BlueprintGetter=GetPollRate, BlueprintSetter=SetPollRate, meta=(Units="Hz"))
+	float PollRate = 0.0f;
+	/// FPlatformTime::Seconds when this sensor is next due to be polled.
+	double NextPollTime = 0.0;
 
 	TArray<int32> LastSensorReading;
+	/// Sized by UButtplugSettings::SensorHistoryCapacity on the first reading.
+	FButtplugSensorHistory SensorHistory;
 	TArray<FLatentSensorAction*> LatentSensorActions;
-	FTimerHandle ResetTimer;
-
-	uint32 ScalarCmdIndex = INDEX_NONE;
-	uint32 RotateCmdIndex = INDEX_NONE;
-	uint32 LinearCmdIndex = INDEX_NONE;
-	uint32 SensorReadCmdIndex = INDEX_NONE;
-	uint32 SensorSubscribeCmdIndex = INDEX_NONE;
-
-	bool bHasQueuedActuation = false;
-	FQueuedActuation QueuedActuation;
+	/// Id of the SensorReadCmd in flight, or 0.
+	uint32 PendingReadId = 0;
+	/// Subscriptions taken with Subscribe and not yet released.
+	int32 SubscriptionCount = 0;
+	/// Has the server been asked for this sensor's readings since its device connected?
+	bool bServerSubscribed = false;
+
+	/// Is this feature listed under this command in its device message attributes, according to its store row?
+	bool HasCmdType(EButtplugMessageType CmdType) const;
+	/// This feature's index in its command's device message attributes, from its store row.
+	uint32 GetCmdIndex() const;
+
+	/// Index of this feature in its device's features.
+	int32 FeatureIndex = INDEX_NONE;
+	/// This feature's row in the subsystem's feature store, which holds its command description and actuation.
+	/// Unset until its device is added to the store, and again once the device is replaced.
+	int32 StoreRow = INDEX_NONE;
+	/// Handle to StoreRow, cached when the row is assigned so that getting it doesn't take HapticsLock.
+	FButtplugFeatureHandle Handle;
 };
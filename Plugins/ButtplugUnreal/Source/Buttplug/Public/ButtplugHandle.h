@@ -0,0 +1,36 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+/// Plain reference to a device of a UButtplugSubsystem, for native code that shouldn't go through UObjects.
+/// Used with the subsystem's native handle API. Goes stale if the server replaces the device, which the API checks.
+struct FButtplugDeviceHandle
+{
+	int32 Slot = INDEX_NONE;
+	uint32 Generation = 0;
+
+	/// Was this handle ever given a device? It may still be stale; see UButtplugSubsystem::IsHandleValid.
+	bool IsSet() const { return Slot != INDEX_NONE; }
+
+	bool operator==(const FButtplugDeviceHandle& Other) const { return Slot == Other.Slot && Generation == Other.Generation; }
+	bool operator!=(const FButtplugDeviceHandle& Other) const { return !(*this == Other); }
+	friend uint32 GetTypeHash(const FButtplugDeviceHandle& Handle) { return HashCombine(::GetTypeHash(Handle.Slot), ::GetTypeHash(Handle.Generation)); }
+};
+
+/// Plain reference to a feature of a UButtplugSubsystem's device, for native code that shouldn't go through UObjects.
+/// Used with the subsystem's native handle API. Goes stale if the server replaces the device, which the API checks.
+struct FButtplugFeatureHandle
+{
+	int32 Row = INDEX_NONE;
+	uint32 Generation = 0;
+
+	/// Was this handle ever given a feature? It may still be stale; see UButtplugSubsystem::IsHandleValid.
+	bool IsSet() const { return Row != INDEX_NONE; }
+
+	bool operator==(const FButtplugFeatureHandle& Other) const { return Row == Other.Row && Generation == Other.Generation; }
+	bool operator!=(const FButtplugFeatureHandle& Other) const { return !(*this == Other); }
+	friend uint32 GetTypeHash(const FButtplugFeatureHandle& Handle) { return HashCombine(::GetTypeHash(Handle.Row), ::GetTypeHash(Handle.Generation)); }
+};
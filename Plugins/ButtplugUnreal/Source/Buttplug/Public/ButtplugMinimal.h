@@ -22,7 +22,12 @@ BUTTPLUG_API DECLARE_LOG_CATEGORY_EXTERN(LogButtplug, Log, All);
 enum class EButtplugMessageType : uint8;
 
 struct FButtplugMessage;
-using FButtplugMessageArray = TArray<TUniquePtr<FButtplugMessage>>;
+struct FButtplugMessageVariant;
+using FButtplugMessageArray = TArray<FButtplugMessageVariant>;
+
+/// Called on the game thread when a sent message fails: the server replied with an error, no reply came in time,
+/// or the connection was reset before a reply.
+using FButtplugMessageFailedFunction = TFunction<void(const FString& Reason)>;
 
 template<EButtplugMessageType MessageType>
 struct TButtplugMessage;
@@ -0,0 +1,86 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "ButtplugHandle.h"
+
+#include <atomic>
+
+/// Immutable copy of a feature's description, as of when its snapshot was published.
+struct FButtplugFeatureSnapshot
+{
+	FButtplugFeatureHandle Handle;
+	EButtplugFeatureType FeatureType = {};
+	FString FeatureDescriptor;
+	bool bActuator = false;
+	int32 ActuatorStepCount = 0;
+	TArray<FInt32Interval> SensorRange;
+};
+
+/// Immutable copy of a device's description, as of when its snapshot was published.
+struct FButtplugDeviceSnapshot
+{
+	FButtplugDeviceHandle Handle;
+	uint32 DeviceIndex = 0;
+	FString DescriptiveName;
+	FString DisplayName;
+	bool bConnected = false;
+	/// Bit N is set if the device has an actuator of feature type N.
+	uint32 ActuatorTypeMask = 0;
+	/// Bit N is set if the device has a sensor of feature type N.
+	uint32 SensorTypeMask = 0;
+	TArray<FButtplugFeatureSnapshot> Features;
+
+	bool CanActuate(EButtplugFeatureType Type) const { return (ActuatorTypeMask >> static_cast<int32>(Type)) & 1; }
+	bool CanSense(EButtplugFeatureType Type) const { return (SensorTypeMask >> static_cast<int32>(Type)) & 1; }
+};
+
+/// Every device a UButtplugSubsystem knows of, connected or not.
+struct FButtplugRegistrySnapshot
+{
+	TArray<FButtplugDeviceSnapshot> Devices;
+};
+
+/// Publishes snapshots of the device registry from the game thread, for reading on any thread without locks or allocation.
+/// Readers pin the current snapshot with an FReadScope. Replaced snapshots are freed on the game thread once no reader
+/// is pinning any snapshot, so read scopes should be short lived.
+class BUTTPLUG_API FButtplugRegistry
+{
+public:
+	/// Pins the registry's current snapshot, which stays valid until the scope ends.
+	class FReadScope
+	{
+	public:
+		explicit FReadScope(const FButtplugRegistry& InRegistry);
+		~FReadScope();
+		UE_NONCOPYABLE(FReadScope);
+
+		const FButtplugRegistrySnapshot& Get() const { return *Snapshot; }
+		const FButtplugRegistrySnapshot& operator*() const { return *Snapshot; }
+		const FButtplugRegistrySnapshot* operator->() const { return Snapshot; }
+
+	private:
+		const FButtplugRegistry& Registry;
+		const FButtplugRegistrySnapshot* Snapshot;
+	};
+
+	FButtplugRegistry();
+	/// Every read scope must have ended.
+	~FButtplugRegistry();
+	UE_NONCOPYABLE(FButtplugRegistry);
+
+	/// Replace the current snapshot. Game thread only.
+	void Publish(FButtplugRegistrySnapshot&& Snapshot);
+	/// Free replaced snapshots, if no reader can still see them. Game thread only.
+	void Reclaim();
+
+private:
+	std::atomic<const FButtplugRegistrySnapshot*> Current;
+	mutable std::atomic<int32> NumReaders = 0;
+	/// Owns Current.
+	TUniquePtr<FButtplugRegistrySnapshot> Published;
+	TArray<TUniquePtr<FButtplugRegistrySnapshot>> Retired;
+};
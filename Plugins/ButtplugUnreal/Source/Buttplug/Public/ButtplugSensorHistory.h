@@ -0,0 +1,63 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+/// Fixed capacity history of a sensor's timestamped readings, overwriting the oldest once full.
+/// Readings are packed NumChannels values each, and statistics over the held readings are kept up to date as they arrive.
+/// Not thread safe; UButtplugFeature records readings on the game thread.
+class BUTTPLUG_API FButtplugSensorHistory
+{
+public:
+	/// Clear the history and size it for Capacity readings of NumChannels values each.
+	void Init(int32 InCapacity, int32 InNumChannels);
+	/// Forget every held reading, keeping the allocation.
+	void Reset();
+	/// Record a reading of NumChannels values, evicting the oldest if full.
+	/// @param Time FPlatformTime::Seconds when the reading was received.
+	void Add(TArrayView<const int32> Reading, double Time);
+
+	int32 Num() const { return Count; }
+	bool IsEmpty() const { return Count == 0; }
+	int32 GetCapacity() const { return Capacity; }
+	int32 GetNumChannels() const { return NumChannels; }
+
+	/// The values of a held reading, Age 0 being the newest. Points into the history, so is only valid until the next Add.
+	TArrayView<const int32> GetReading(int32 Age = 0) const;
+	/// When a held reading was received, Age 0 being the newest.
+	double GetTime(int32 Age = 0) const;
+	/// Every held reading's values, oldest first, as the two packed spans either side of the ring's wrap point.
+	/// OutNewer is empty if the readings don't wrap. Only valid until the next Add.
+	void GetSpans(TArrayView<const int32>& OutOlder, TArrayView<const int32>& OutNewer) const;
+
+	/// Mean of a channel over the held readings.
+	double GetAverage(int32 Channel = 0) const;
+	/// Least value of a channel over the held readings.
+	int32 GetMin(int32 Channel = 0) const;
+	/// Greatest value of a channel over the held readings.
+	int32 GetMax(int32 Channel = 0) const;
+	/// Change of a channel per second, from the oldest held reading to the newest.
+	double GetRateOfChange(int32 Channel = 0) const;
+
+private:
+	/// Index into Times of a held reading; into Samples, once multiplied by NumChannels.
+	int32 GetSlot(int32 Age) const { return (Next - 1 - Age + Capacity) % Capacity; }
+	void RescanExtremes(int32 Channel) const;
+
+	TArray<int32> Samples;
+	TArray<double> Times;
+	int32 Capacity = 0;
+	int32 NumChannels = 0;
+	/// The slot the next reading goes in.
+	int32 Next = 0;
+	int32 Count = 0;
+
+	/// Sum of each channel over the held readings.
+	TArray<int64> Sums;
+	mutable TArray<int32> Mins;
+	mutable TArray<int32> Maxes;
+	/// Set for channels that evicted one of their extremes, which are rescanned when next asked for.
+	mutable TBitArray<> StaleExtremes;
+};
@@ -0,0 +1,92 @@
+// Copyright 2024 Christopher Durham. SPDX-License-Identifier: BSD-3-Clause
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ButtplugMinimal.h"
+
+#include "Engine/DeveloperSettings.h"
+
+#include "ButtplugSettings.generated.h"
+
+/// What to do with outgoing messages while the Buttplug server is falling behind.
+UENUM()
+enum class EButtplugBackpressurePolicy : uint8
+{
+	/// Hold actuation back in each feature, so that only the latest value is sent once the server catches up.
+	CoalesceLatest,
+	/// Queue actuation and sensor reads, sending everything else; when the queue is full the oldest of them are dropped.
+	DropOldest,
+};
+
+/// Project settings for the Buttplug client.
+UCLASS(Config=Game, DefaultConfig, meta=(DisplayName="Buttplug"))
+class BUTTPLUG_API UButtplugSettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+	UButtplugSettings(const FObjectInitializer& ObjectInitializer);
+
+public:
+	/// Encode, decode and send messages on a dedicated network thread instead of the game thread.
+	/// Only decoded server events are handed back to the game thread. Takes effect on the next connection.
+	UPROPERTY(Config, EditAnywhere, Category="Networking")
+	bool bUseNetworkThread = false;
+
+	/// How long to wait for the server to reply to a message before counting it as failed.
+	UPROPERTY(Config, EditAnywhere, Category="Networking", meta=(ClampMin=0.1, Units="s"))
+	float MessageTimeout = 5.0f;
+
+	/// Number of messages awaiting a reply at which the server counts as congested.
+	/// It stops counting as congested once down to half this.
+	UPROPERTY(Config, EditAnywhere, Category="Networking", meta=(ClampMin=2))
+	int32 CongestionHighWatermark = 64;
+
+	/// What to do with actuation and sensor reads while the server is congested. Other messages are always sent.
+	UPROPERTY(Config, EditAnywhere, Category="Networking")
+	EButtplugBackpressurePolicy BackpressurePolicy = EButtplugBackpressurePolicy::CoalesceLatest;
+
+	/// Most messages queued to be sent. When full, the oldest actuation or sensor read is dropped; other messages never are.
+	UPROPERTY(Config, EditAnywhere, Category="Networking", meta=(ClampMin=1))
+	int32 MaxQueuedMessages = 256;
+
+	/// Adapt how often each device is sent to from how quickly the server replies, never faster than the device's timing gap.
+	UPROPERTY(Config, EditAnywhere, Category="Networking")
+	bool bAdaptiveSendRate = true;
+
+	/// Replies slower than this make adaptive rate control back off.
+	UPROPERTY(Config, EditAnywhere, Category="Networking", meta=(EditCondition="bAdaptiveSendRate", ClampMin=0.001, Units="s"))
+	float SendRateLatencyTarget = 0.1f;
+
+	/// The longest adaptive rate control will wait between sends to a device.
+	UPROPERTY(Config, EditAnywhere, Category="Networking", meta=(EditCondition="bAdaptiveSendRate", ClampMin=0.001, Units="s"))
+	float MaxSendInterval = 0.5f;
+
+	/// Flush queued actuation on a dedicated fixed-rate clock thread instead of once per game frame.
+	/// Keeps haptics running smoothly through hitches and honours device timing gaps to well under a frame.
+	/// Sends through the network thread, which is used whenever this is on, even if bUseNetworkThread is off.
+	UPROPERTY(Config, EditAnywhere, Category="Haptics")
+	bool bUseHapticsClock = false;
+
+	/// How many times per second the haptics clock flushes queued actuation.
+	UPROPERTY(Config, EditAnywhere, Category="Haptics", meta=(EditCondition="bUseHapticsClock", ClampMin=10, ClampMax=1000, Units="Hz"))
+	int32 HapticsClockRate = 100;
+
+	/// Actuation is only sent when it changes the value on the device's step grid.
+	/// If positive, active actuation is resent after this long anyway, for devices that time out on their own.
+	UPROPERTY(Config, EditAnywhere, Category="Haptics", meta=(ClampMin=0, Units="s"))
+	float ActuationKeepAliveInterval = 0.0f;
+
+	/// How many readings each sensor feature keeps, for its history and statistics.
+	UPROPERTY(Config, EditAnywhere, Category="Sensors", meta=(ClampMin=1))
+	int32 SensorHistoryCapacity = 64;
+
+	/// Most sensor polls sent per second, across all devices. Polls beyond it wait for a later tick.
+	UPROPERTY(Config, EditAnywhere, Category="Sensors", meta=(ClampMin=0.1))
+	float SensorPollBudget = 10.0f;
+
+	/// How often battery levels are polled, so that UButtplugDevice::GetBatteryLevel stays current. 0 to never poll them.
+	UPROPERTY(Config, EditAnywhere, Category="Sensors", meta=(ClampMin=0, Units="s"))
+	float BatteryPollInterval = 60.0f;
+};
@@ -5,9 +5,18 @@
 #include "CoreMinimal.h"
 #include "ButtplugMinimal.h"
 
+#include "ButtplugDevice.h"
+#include "ButtplugHandle.h"
+#include "ButtplugRegistry.h"
+#include "Containers/Queue.h"
+#include "HAL/CriticalSection.h"
+#include "Misc/ScopeLock.h"
+#include "Misc/TVariant.h"
 #include "Subsystems/GameInstanceSubsystem.h"
 #include "Tickable.h"
 
+#include <atomic>
+
 #include "ButtplugSubsystem.generated.h"
 
 UENUM()
@@ -19,6 +28,26 @@ enum class EButtplugClientStartResult : uint8
 	ConnectionFailed,
 };
 
+/// Pacing statistics of the fixed-rate haptics clock.
+USTRUCT(BlueprintType)
+struct FButtplugHapticsClockStats
+{
+	GENERATED_BODY()
+
+	/// Number of ticks run since the clock started.
+	UPROPERTY(BlueprintReadOnly)
+	int64 TickCount = 0;
+	/// Number of ticks skipped because the clock fell more than a full period behind.
+	UPROPERTY(BlueprintReadOnly)
+	int64 MissedTickCount = 0;
+	/// Average time a tick ran after it was scheduled.
+	UPROPERTY(BlueprintReadOnly, meta=(Units="ms"))
+	float MeanJitter = 0.0f;
+	/// Longest time a tick ran after it was scheduled.
+	UPROPERTY(BlueprintReadOnly, meta=(Units="ms"))
+	float MaxJitter = 0.0f;
+};
+
 UCLASS()
 class BUTTPLUG_API UButtplugSubsystem : public UGameInstanceSubsystem, public FTickableGameObject
 {
@@ -27,6 +56,14 @@ class BUTTPLUG_API UButtplugSubsystem : public UGameInstanceSubsystem, public FT
 private:
 	class FLatentStartAction;
 	friend class ThisClass::FLatentStartAction;
+	friend class UButtplugDevice;
+	friend class UButtplugFeature;
+
+public:
+	// Defined out of line, where the message types held in our queues are complete.
+	UButtplugSubsystem();
+	UButtplugSubsystem(FVTableHelper& Helper);
+	virtual ~UButtplugSubsystem();
 	
 	// USubsystem implementation
 public:
@@ -55,6 +92,38 @@ public:
 	/// All devices known to this client, including disconnected ones.
 	UFUNCTION(BlueprintCallable)
 	void GetAllDevices(TArray<UButtplugDevice*>& Devices) const;
+	/// Snapshots of all known devices, readable from any thread; see FButtplugRegistry::FReadScope.
+	/// Republished whenever a device is added, removed or disconnected.
+	const FButtplugRegistry& GetRegistry() const { return Registry; }
+
+	/// Pacing statistics of the haptics clock, if enabled in UButtplugSettings.
+	UFUNCTION(BlueprintCallable)
+	FButtplugHapticsClockStats GetHapticsClockStats() const;
+
+	/// Round trip latency of all messages sent to the Buttplug server.
+	UFUNCTION(BlueprintCallable)
+	FButtplugLatencyStats GetLatencyStats() const;
+	/// Round trip latency of messages sent to one device.
+	FButtplugLatencyStats GetDeviceLatencyStats(uint32 DeviceIndex) const;
+	/// Round trip latency of one type of message.
+	FButtplugLatencyStats GetMessageTypeLatencyStats(EButtplugMessageType MessageType) const;
+	/// Time from requesting a stop, with UButtplugDevice::Stop or StopAllDevices, to the server confirming it.
+	UFUNCTION(BlueprintCallable)
+	FButtplugLatencyStats GetTimeToStopStats() const;
+	/// Set the range a device's adaptive send interval can move in.
+	void SetDeviceSendIntervalLimits(uint32 DeviceIndex, double MinInterval, double MaxInterval);
+	/// The adaptive interval between sends to a device, no shorter than MinInterval.
+	double GetDeviceSendInterval(uint32 DeviceIndex, double MinInterval) const;
+
+	/// Is the server falling behind on replies? See UButtplugSettings::BackpressurePolicy.
+	UFUNCTION(BlueprintCallable)
+	bool IsCongested() const;
+	/// Number of sent messages still waiting for a reply.
+	UFUNCTION(BlueprintCallable)
+	int32 GetNumMessagesInFlight() const;
+	/// Number of queued messages dropped because the send queue was full or a stop cancelled them.
+	UFUNCTION(BlueprintCallable)
+	int64 GetDroppedMessageCount() const;
 
 	// Events
 public:
@@ -62,6 +131,8 @@ public:
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE(FOnEvent);
 	UDELEGATE()
 	DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnDeviceEvent, UButtplugDevice*, Device);
+	UDELEGATE()
+	DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnCongestionEvent, bool, bCongested);
 
 	/// Called after connecting to a Bluttplug server.
 	UPROPERTY(BlueprintAssignable)
@@ -80,6 +151,10 @@ public:
 	/// Called whenever a device is removed from the system.
 	UPROPERTY(BlueprintAssignable)
 	FOnDeviceEvent OnDeviceRemoved;
+	/// Called when the server starts falling behind on replies, and when it catches back up.
+	/// Gameplay can use this to send less, e.g. by lowering actuation detail.
+	UPROPERTY(BlueprintAssignable)
+	FOnCongestionEvent OnCongestionChanged;
 
 	// Messages
 public:
@@ -91,6 +166,33 @@ public:
 	/// Useful for protocols like Bluetooth, which may not timeout otherwise.
 	UFUNCTION(BlueprintCallable)
 	void StopScanning();
+	/// Stop all actuation of every device.
+	/// Sent immediately from the calling thread, ahead of any queued messages.
+	UFUNCTION(BlueprintCallable)
+	void StopAllDevices();
+
+	// Native handle API
+	// For native code, e.g. animation or audio callbacks, that shouldn't hold UObjects or go through Blueprint thunks.
+	// Handles index the subsystem's feature store directly; calls with stale handles do nothing and return false.
+	// Actuate may be called from any thread; its handle is checked when the actuation is merged on the send path.
+public:
+	FButtplugDeviceHandle GetDeviceHandle(const UButtplugDevice* Device) const;
+	FButtplugFeatureHandle GetFeatureHandle(const UButtplugFeature* Feature) const;
+	/// Handle to the Nth feature of the given type of a device, or an unset handle if there is none.
+	FButtplugFeatureHandle FindFeature(FButtplugDeviceHandle Device, EButtplugFeatureType FeatureType, int32 Nth = 0) const;
+	/// Does this handle still refer to a device, i.e. the server hasn't replaced it?
+	bool IsHandleValid(FButtplugDeviceHandle Device) const;
+	/// Does this handle still refer to a feature, i.e. the server hasn't replaced its device?
+	bool IsHandleValid(FButtplugFeatureHandle Feature) const;
+	/// Is the device connected and addressable?
+	bool IsDeviceConnected(FButtplugDeviceHandle Device) const;
+	/// Actuate an actuator feature. See UButtplugFeature::Actuate.
+	/// Lock free; returns false only for an unset handle.
+	bool Actuate(FButtplugFeatureHandle Feature, double Value, float Duration = 0.0f);
+	/// Poll a reading from a sensor feature. The reading arrives through the feature's OnSensorReading.
+	bool Read(FButtplugFeatureHandle Feature);
+	/// Stop all actuation of a device. See UButtplugDevice::Stop.
+	bool StopDevice(FButtplugDeviceHandle Device);
 
 	// Connection
 public:
@@ -121,11 +223,52 @@ public:
 
 	// Lifecycle helpers
 public:
-	void EnqueueMessage(TUniquePtr<FButtplugMessage> Message);
+	/// Queue a message to be sent next tick. Safe to call from any thread.
+	/// @param OnFailed Called if the server replies with an error, doesn't reply in time, or the connection is reset first.
+	/// @return The Id assigned to the message.
+	template<typename MessageType>
+	uint32 EnqueueMessage(MessageType&& Message, FButtplugMessageFailedFunction&& OnFailed = nullptr);
+	/// Queue a message to be sent next tick. Safe to call from any thread.
+	/// @param OnFailed Called if the server replies with an error, doesn't reply in time, or the connection is reset first.
+	/// @return The Id assigned to the message.
+	uint32 EnqueueMessage(FButtplugMessageVariant&& Message, FButtplugMessageFailedFunction&& OnFailed = nullptr);
+	/// Send a stop message right away from the calling thread, ahead of anything queued.
+	/// Queued actuation for the devices it stops is cancelled, since it would only restart them.
+	/// @param OnFailed Called if the server replies with an error, doesn't reply in time, or the connection is reset first.
+	/// @return The Id assigned to the message.
+	uint32 SendPriorityMessage(FButtplugMessageVariant&& Message, FButtplugMessageFailedFunction&& OnFailed = nullptr);
+	/// Guards queued actuation and outgoing messages, which the haptics clock flushes from its own thread.
+	FCriticalSection& GetHapticsLock() { return HapticsLock; }
+	/// Should actuation stay queued in its feature rather than be sent, because the server is congested?
+	bool IsHoldingActuation() const;
 private:
+	/// Add a message to this flush's send buffer. HapticsLock must be held.
+	template<typename MessageType>
+	uint32 BufferMessage(MessageType&& Message);
+	uint32 BufferMessage(FButtplugMessageVariant&& Message);
+	/// Merge actuation and messages submitted from other threads into the feature store and send buffer. HapticsLock must be held.
+	void DrainSubmissions();
+	/// Drop everything submitted but not yet drained, failing its callbacks.
+	void DiscardSubmissions();
+	void SetMessageFailedCallback(uint32 Id, FButtplugMessageFailedFunction&& OnFailed);
+	/// Drop the oldest droppable message if the send queue is full.
+	void MakeRoomForMessage();
+	void FlushMessages(float DeltaTime);
+	void SendBatch(FButtplugMessageArray& Batch);
 	void StartPingTimer(float PingRate);
 	void TickPingTimer();
 	void Reset(const FString& Reason);
+	/// Close the socket, first joining the clock and worker, so that no other thread is using it.
+	void CloseSocket(int32 CloseCode, const FString& Reason);
+	/// Publish a new snapshot of Devices to Registry.
+	void PublishRegistry();
+	/// Route readings for a newly added device's sensors to its features.
+	void AddSensorRoutes(UButtplugDevice* Device);
+	void RemoveSensorRoutes(uint32 DeviceIndex);
+	/// Start polling a feature at its poll rate.
+	void SchedulePoll(UButtplugFeature* Feature);
+	/// Poll the sensors that are due, within the poll budget.
+	void TickPolls(float DeltaTime);
 
 	// Socket callbacks
 private:
@@ -135,6 +278,7 @@ private:
 	template<EButtplugMessageType MessageType>
 	void OnServerMessage(const TButtplugMessage<MessageType>& Message);
 	void OnSocketMessage(const FString& MessageString);
+	void DispatchIncomingMessages();
 
 private:
 	bool bInitialized = false;
@@ -150,11 +294,86 @@ private:
 	FString ServerAddress;
 
 	FTimerHandle PingTimer;
-	uint32 NextMessageId = 1;
+	/// Allocated atomically, since messages can be submitted from any thread.
+	std::atomic<uint32> NextMessageId = 1;
+	struct FSubmittedActuation
+	{
+		FButtplugFeatureHandle Feature;
+		double Value = 0.0;
+		float Duration = 0.0f;
+		/// FPlatformTime::Seconds when submitted, which Duration counts from.
+		double SubmitTime = 0.0;
+	};
+	/// Actuation submitted from any thread, merged into FeatureStore on the send path.
+	TQueue<FSubmittedActuation, EQueueMode::Mpsc> SubmittedActuations;
+	/// Messages submitted from any thread, moved into MessageBuffer on the send path.
+	TQueue<FButtplugMessageVariant, EQueueMode::Mpsc> SubmittedMessages;
+	/// Messages to send this tick. Reset after sending, keeping its allocation.
 	FButtplugMessageArray MessageBuffer;
+	/// Stop commands sent ahead of MessageBuffer.
+	FButtplugMessageArray PriorityBuffer;
+	/// UTF-8 encoded MessageBuffer, kept around to reuse its allocation.
+	TArray<ANSICHAR> SendBuffer;
+	/// Messages decoded from the current socket frame or network worker batch. Reset after dispatch.
+	FButtplugMessageArray IncomingMessages;
 	TSharedPtr<class IWebSocket> WebSocket;
+	/// Encodes, decodes and sends messages off the game thread, if enabled in UButtplugSettings.
+	TUniquePtr<class FButtplugNetworkWorker> NetworkWorker;
+	/// Flushes queued messages at a fixed rate off the game thread, if enabled in UButtplugSettings.
+	TUniquePtr<class FButtplugHapticsClock> HapticsClock;
+	/// Matches replies to sent messages, measuring their latency.
+	TUniquePtr<class FButtplugMessageTracker> MessageTracker;
+	/// Command descriptions and actuation of every device's features, flushed under HapticsLock.
+	TUniquePtr<class FButtplugFeatureStore> FeatureStore;
+	mutable FCriticalSection HapticsLock;
+	/// Updated while flushing, which may be on the haptics clock thread.
+	std::atomic<bool> bCongested = false;
+	/// The congestion state last broadcast from the game thread.
+	bool bReportedCongested = false;
+	std::atomic<int64> DroppedMessageCount = 0;
 	FLatentStartAction* LatentStartAction = nullptr;
 
 	UPROPERTY()
 	TMap<uint32, TObjectPtr<UButtplugDevice>> Devices;
+	FButtplugRegistry Registry;
+
+	/// Identifies the sensor a SensorReading is for.
+	struct FSensorRouteKey
+	{
+		uint32 DeviceIndex = 0;
+		EButtplugFeatureType SensorType = {};
+		uint32 SensorIndex = 0;
+
+		bool operator==(const FSensorRouteKey& Other) const { return DeviceIndex == Other.DeviceIndex && SensorType == Other.SensorType && SensorIndex == Other.SensorIndex; }
+		friend uint32 GetTypeHash(const FSensorRouteKey& Key) { return HashCombine(HashCombine(::GetTypeHash(Key.DeviceIndex), ::GetTypeHash(static_cast<uint8>(Key.SensorType))), ::GetTypeHash(Key.SensorIndex)); }
+	};
+	/// The features a SensorReading is delivered to. Kept alive by their device.
+	struct FSensorRoute
+	{
+		TObjectPtr<UButtplugFeature> ReadFeature;
+		TObjectPtr<UButtplugFeature> SubscribeFeature;
+	};
+	/// Built as devices are added, so that dispatching a reading is a single lookup.
+	TMap<FSensorRouteKey, FSensorRoute> SensorRoutes;
+
+	/// Features with a poll rate. Removed once their rate is cleared or they're destroyed with a replaced device.
+	TArray<TWeakObjectPtr<UButtplugFeature>> PolledFeatures;
+	/// Polls due this tick, kept around to reuse its allocation.
+	TArray<UButtplugFeature*> DuePolls;
+	/// Polls that can be sent without exceeding UButtplugSettings::SensorPollBudget.
+	double PollAllowance = 0.0;
 };
+
+template<typename MessageType>
+uint32 UButtplugSubsystem::EnqueueMessage(MessageType&& Message, FButtplugMessageFailedFunction&& OnFailed)
+{
+	using FQueuedMessageType = std::decay_t<MessageType>;
+	return EnqueueMessage(FButtplugMessageVariant(TInPlaceType<FQueuedMessageType>(), Forward<MessageType>(Message)), MoveTemp(OnFailed));
+}
+
+template<typename MessageType>
+uint32 UButtplugSubsystem::BufferMessage(MessageType&& Message)
+{
+	using FQueuedMessageType = std::decay_t<MessageType>;
+	return BufferMessage(FButtplugMessageVariant(TInPlaceType<FQueuedMessageType>(), Forward<MessageType>(Message)));
+}